@@ -0,0 +1,79 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include "BlockOrder.h"
+
+// Number of Feistel rounds
+#define ROUNDS 4
+
+BlockOrder::BlockOrder(Kind kind_, long long blocks_, long long stride_,
+                       uint64_t key_):
+    kind(kind_), blocks(blocks_), stride(stride_), key(key_), halfBits(1) {
+  // The network permutes 0..2^(2*halfBits)-1, which must cover every block
+  while(halfBits < 31 && (1ULL << (2 * halfBits)) < (uint64_t)blocks)
+    ++halfBits;
+}
+
+// Mix the bits of X (the SplitMix64 finalizer)
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+uint64_t BlockOrder::feistel(uint64_t x) const {
+  const uint64_t mask = (1ULL << halfBits) - 1;
+  uint64_t left = x >> halfBits, right = x & mask;
+  for(int round = 0; round < ROUNDS; ++round) {
+    uint64_t next = left ^ (mix(key + round * 0x9e3779b97f4a7c15ULL + right)
+                            & mask);
+    left = right;
+    right = next;
+  }
+  return (left << halfBits) | right;
+}
+
+long long BlockOrder::block(long long i) const {
+  switch(kind) {
+  case SEQUENTIAL: break;
+  case REVERSE: return blocks - 1 - i;
+  case RANDOM: {
+    // Cycle-walk until the result is in range. The network's domain is
+    // less than four times the number of blocks, so this is quick.
+    uint64_t x = i;
+    do
+      x = feistel(x);
+    while(x >= (uint64_t)blocks);
+    return x;
+  }
+  case STRIDE: {
+    // The first blocks % stride sequences have one more block than the
+    // rest
+    long long shorter = blocks / stride, extra = blocks % stride;
+    long long big = extra * (shorter + 1);
+    if(i < big)
+      return i / (shorter + 1) + i % (shorter + 1) * stride;
+    i -= big;
+    return extra + i / shorter + i % shorter * stride;
+  }
+  }
+  return i;
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BLOCKORDER_H
+#define BLOCKORDER_H
+
+#include <stdint.h>
+
+// The order in which to visit the blocks of a target. Nothing is stored
+// per block, so any number of blocks can be handled.
+class BlockOrder {
+public:
+  enum Kind { SEQUENTIAL, REVERSE, RANDOM, STRIDE };
+
+  // Visit BLOCKS blocks. For STRIDE, every STRIDE'th block is visited,
+  // starting from 0, then from 1, and so on. For RANDOM, KEY selects the
+  // permutation.
+  BlockOrder(Kind kind, long long blocks, long long stride, uint64_t key);
+
+  // Return the block to visit at step I, where 0 <= I < blocks.
+  long long block(long long i) const;
+
+private:
+  Kind kind;
+  long long blocks;
+  long long stride;
+  uint64_t key;
+  int halfBits; // bits in each half of the Feistel network
+
+  uint64_t feistel(uint64_t x) const;
+};
+
+#endif /* BLOCKORDER_H */
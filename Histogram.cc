@@ -0,0 +1,72 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include "Histogram.h"
+
+Histogram &Histogram::operator=(const Histogram &that) {
+  for(unsigned n = 0; n < BUCKETS; ++n)
+    counts[n].store(that.counts[n].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+  total.store(that.count(), std::memory_order_relaxed);
+  maximum.store(that.max(), std::memory_order_relaxed);
+  return *this;
+}
+
+void Histogram::clear() {
+  for(unsigned n = 0; n < BUCKETS; ++n)
+    counts[n].store(0, std::memory_order_relaxed);
+  total.store(0, std::memory_order_relaxed);
+  maximum.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::merge(const Histogram &that) {
+  for(unsigned n = 0; n < BUCKETS; ++n)
+    counts[n].store(counts[n].load(std::memory_order_relaxed)
+                        + that.counts[n].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+  total.store(count() + that.count(), std::memory_order_relaxed);
+  if(that.max() > max())
+    maximum.store(that.max(), std::memory_order_relaxed);
+}
+
+// Return the smallest value that goes in BUCKET
+uint64_t Histogram::lowest(unsigned bucket) {
+  if(bucket < 2 * SUB)
+    return bucket;
+  const unsigned e = bucket / SUB + SUB_BITS - 1;
+  return (uint64_t)(SUB + bucket % SUB) << (e - SUB_BITS);
+}
+
+uint64_t Histogram::percentile(double fraction) const {
+  const uint64_t values = count(), largest = max();
+  if(!values)
+    return 0;
+  uint64_t rank = fraction * values;
+  if(rank < fraction * values || !rank)
+    ++rank;
+  uint64_t seen = 0;
+  for(unsigned n = 0; n < BUCKETS; ++n) {
+    seen += counts[n].load(std::memory_order_relaxed);
+    if(seen >= rank) {
+      // Report the top of the bucket, but never more than was really seen
+      const uint64_t top = n + 1 < BUCKETS ? lowest(n + 1) - 1 : largest;
+      return top < largest ? top : largest;
+    }
+  }
+  return largest;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+// A log-linear histogram of durations in nanoseconds. Each power of two is
+// split into 32 buckets, so values are kept to within about 3%, the size is
+// fixed and adding a value is cheap.
+//
+// Only one thread may add values, but others may read them at the same time
+// (for instance to report on a run in progress).
+class Histogram {
+public:
+  Histogram() { clear(); }
+
+  Histogram(const Histogram &that) { *this = that; }
+
+  Histogram &operator=(const Histogram &that);
+
+  // Forget all values
+  void clear();
+
+  // Add VALUE
+  void add(uint64_t value) {
+    bump(counts[bucket(value)]);
+    bump(total);
+    if(value > maximum.load(std::memory_order_relaxed))
+      maximum.store(value, std::memory_order_relaxed);
+  }
+
+  // Add all of THAT's values
+  void merge(const Histogram &that);
+
+  // Return the number of values
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+  // Return the largest value
+  uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+  // Return (approximately) the smallest value that FRACTION of all values
+  // are less than or equal to.
+  uint64_t percentile(double fraction) const;
+
+private:
+  enum {
+    SUB_BITS = 5,
+    SUB = 1 << SUB_BITS,
+    BUCKETS = (64 - SUB_BITS + 1) * SUB,
+  };
+  std::atomic<uint64_t> counts[BUCKETS];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> maximum;
+
+  // Increment N. There is only one writer, so this needn't be locked.
+  static void bump(std::atomic<uint64_t> &n) {
+    n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  static unsigned bucket(uint64_t value) {
+    if(value < SUB)
+      return value;
+    const unsigned e = 63 - __builtin_clzll(value);
+    return (e - SUB_BITS + 1) * SUB + ((value >> (e - SUB_BITS)) & (SUB - 1));
+  }
+
+  static uint64_t lowest(unsigned bucket);
+};
+
+#endif /* HISTOGRAM_H */
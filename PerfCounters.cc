@@ -0,0 +1,129 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include "PerfCounters.h"
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#if HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// One call to start() in this many is counted
+#define PERF_SAMPLE 64
+
+PerfCounters::PerfCounters(): bytes(0), calls(0) {
+  for(int n = 0; n < COUNTERS; ++n)
+    fds[n] = -1;
+}
+
+#if HAVE_LINUX_PERF_EVENT_H
+// Explain why perf_event_open() failed with ERRNO
+static std::string explain(int errno_value) {
+  std::string error = std::string("perf_event_open: ") + strerror(errno_value);
+  if(errno_value == EACCES || errno_value == EPERM) {
+    FILE *fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    int paranoid;
+    if(fp && fscanf(fp, "%d", &paranoid) == 1) {
+      char buffer[128];
+      snprintf(buffer, sizeof buffer,
+               " (kernel.perf_event_paranoid is %d; it must be 2 or less, or "
+               "run as root)",
+               paranoid);
+      error += buffer;
+    }
+    if(fp)
+      fclose(fp);
+  } else if(errno_value == ENOENT || errno_value == EOPNOTSUPP
+            || errno_value == ENODEV)
+    error += " (no hardware counters; perhaps this is a virtual machine)";
+  return error;
+}
+
+bool PerfCounters::open(std::string &error) {
+  static const uint64_t configs[COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES,
+  };
+  close();
+  bytes = 0;
+  calls = 0;
+  for(int n = 0; n < COUNTERS; ++n) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[n];
+    // The group is enabled and disabled as a whole, via its leader
+    attr.disabled = n == CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fds[n] = syscall(SYS_perf_event_open, &attr, 0, -1, fds[CYCLES], 0);
+    if(fds[n] < 0 && n == CYCLES) {
+      error = explain(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PerfCounters::start() {
+  if(calls++ % PERF_SAMPLE)
+    return false;
+  ioctl(fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+void PerfCounters::stop(uint64_t bytes_) {
+  ioctl(fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  bytes += bytes_;
+}
+
+bool PerfCounters::read(Counter counter, uint64_t &value) const {
+  return fds[counter] >= 0
+         && ::read(fds[counter], &value, sizeof value) == sizeof value;
+}
+#else
+bool PerfCounters::open(std::string &error) {
+  error = "hardware performance counters are not supported on this platform";
+  return false;
+}
+
+bool PerfCounters::start() {
+  return false;
+}
+
+void PerfCounters::stop(uint64_t) {}
+
+bool PerfCounters::read(Counter, uint64_t &) const {
+  return false;
+}
+#endif
+
+void PerfCounters::close() {
+  for(int n = 0; n < COUNTERS; ++n)
+    if(fds[n] >= 0) {
+      ::close(fds[n]);
+      fds[n] = -1;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+#include <string>
+
+// Hardware performance counters for a region of code in one thread. The
+// counters only run between start() and stop(), so several regions can be
+// measured separately. Only a sample of the calls are counted, so that the
+// system calls to start and stop the counters don't distort the run.
+class PerfCounters {
+public:
+  enum Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    COUNTERS,
+  };
+
+  PerfCounters();
+  ~PerfCounters() { close(); }
+
+  // The counters belong to one object, so they can't be copied
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  // Open counters for the calling thread. If they are unavailable, return
+  // false and set ERROR to say why. Individual counters other than CYCLES
+  // may be missing even if this succeeds.
+  bool open(std::string &error);
+
+  // Close the counters, if they are open
+  void close();
+
+  // Return true if the counters are open
+  bool opened() const { return fds[CYCLES] >= 0; }
+
+  // Start counting, if this call is one of the sample. Return true if
+  // counting started, in which case stop() must be called.
+  bool start();
+
+  // Stop counting, having processed BYTES bytes
+  void stop(uint64_t bytes);
+
+  // Return the bytes processed so far, in the calls sampled
+  uint64_t processed() const { return bytes; }
+
+  // Read the total for COUNTER into VALUE. Return false if it is missing.
+  bool read(Counter counter, uint64_t &value) const;
+
+private:
+  int fds[COUNTERS];
+  uint64_t bytes;
+  uint64_t calls; // calls to start()
+};
+
+#endif /* PERFCOUNTERS_H */
@@ -0,0 +1,43 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <chrono>
+#include <thread>
+#include "TokenBucket.h"
+
+void TokenBucket::configure(double rate, double burst_) {
+  cost = rate > 0 ? 1e9 / rate : 0;
+  burst = burst_ * 1e9;
+}
+
+void TokenBucket::take(uint64_t tokens) {
+  const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+  // Tokens not taken while idle are lost, apart from the burst allowance
+  uint64_t old = due.load(std::memory_order_relaxed), next;
+  do
+    next = (old > now ? old : now) + (uint64_t)(tokens * cost);
+  while(!due.compare_exchange_weak(old, next, std::memory_order_relaxed));
+  // Within the burst allowance, carry on without waiting. Otherwise wait
+  // until half of it is available again, so that waits are neither tiny
+  // nor frequent.
+  if(next > now + burst)
+    std::this_thread::sleep_for(
+        std::chrono::nanoseconds(next - now - burst / 2));
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <stdint.h>
+#include <atomic>
+
+// A token bucket that can be shared between threads. Tokens are earned at
+// a fixed rate, and up to a short burst of them can be saved up. Taking
+// more than are available waits until they have been earned.
+class TokenBucket {
+public:
+  TokenBucket(): cost(0), burst(0), due(0) {}
+
+  // Earn RATE tokens per second, saving up at most BURST seconds' worth.
+  // A RATE of 0 means there is no limit.
+  void configure(double rate, double burst);
+
+  // Return true if there is a limit
+  bool limited() const { return cost > 0; }
+
+  // Take TOKENS tokens, waiting until they are available
+  void take(uint64_t tokens);
+
+private:
+  double cost;                // nanoseconds to earn each token
+  uint64_t burst;             // nanoseconds of tokens that can be saved
+  std::atomic<uint64_t> due;  // when all tokens taken so far are earned
+};
+
+#endif /* TOKENBUCKET_H */
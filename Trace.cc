@@ -0,0 +1,132 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "vbig.h"
+#include <cerrno>
+#include <cstring>
+#include "Trace.h"
+
+// Return S as a JSON string, with quotes
+std::string json_quote(const std::string &s) {
+  std::string result = "\"";
+  for(size_t n = 0; n < s.size(); ++n) {
+    const unsigned char c = s[n];
+    if(c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if(c < 0x20) {
+      char buffer[8];
+      snprintf(buffer, sizeof buffer, "\\u%04x", c);
+      result += buffer;
+    } else
+      result += c;
+  }
+  return result + "\"";
+}
+
+// Number of records the ring holds
+#define TRACE_RING 4096
+
+Trace::Trace(const char *path_, bool json_):
+    path(path_), json(json_), fp(fopen(path_, "w")), ring(TRACE_RING),
+    head(0), tail(0), dropped(0), stopping(false), error(0) {
+  if(!fp)
+    fatal(errno, "open %s", path_);
+  if(!json)
+    fprintf(fp, "path,pass,phase,offset,bytes,elapsed,seconds,mbps\n");
+  writer = std::thread([this] { run(); });
+}
+
+Trace::~Trace() {
+  if(fp)
+    close();
+}
+
+void Trace::record(const TraceRecord &r) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(tail - head == ring.size()) {
+    ++dropped;
+    return;
+  }
+  ring[tail++ % ring.size()] = r;
+  changed.notify_one();
+}
+
+void Trace::close() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    changed.notify_one();
+  }
+  writer.join();
+  if(!error && (ferror(fp) || fflush(fp)))
+    error = errno;
+  if(fclose(fp) < 0 && !error)
+    error = errno;
+  fp = 0;
+  if(dropped)
+    fprintf(stderr, "WARNING: %s: %zu trace records dropped\n", path.c_str(),
+            dropped);
+  if(error)
+    fatal(error, "write %s", path.c_str());
+}
+
+// Write out records as they arrive, until close() is called
+void Trace::run() {
+  std::unique_lock<std::mutex> guard(lock);
+  for(;;) {
+    while(head == tail && !stopping)
+      changed.wait(guard);
+    if(head == tail)
+      break;
+    // Don't hold the lock while writing
+    const TraceRecord r = ring[head % ring.size()];
+    guard.unlock();
+    write(r);
+    guard.lock();
+    ++head;
+  }
+}
+
+void Trace::write(const TraceRecord &r) {
+  const double mbps = r.seconds > 0 ? r.bytes / r.seconds / 1e6 : 0.0;
+  if(json) {
+    fprintf(fp,
+            "{\"path\":%s,\"pass\":%lld,\"phase\":\"%s\",\"offset\":%lld,"
+            "\"bytes\":%lld,\"elapsed\":%.6f,\"seconds\":%.6f,"
+            "\"mbps\":%.3f}\n",
+            json_quote(r.path).c_str(), r.pass, r.phase, r.offset, r.bytes,
+            r.elapsed, r.seconds, mbps);
+  } else {
+    // Quote paths that would otherwise break the CSV
+    if(r.path.find_first_of(",\"\n") != std::string::npos) {
+      fputc('"', fp);
+      for(const char *s = r.path.c_str(); *s; ++s) {
+        if(*s == '"')
+          fputc('"', fp);
+        fputc(*s, fp);
+      }
+      fputc('"', fp);
+    } else
+      fputs(r.path.c_str(), fp);
+    fprintf(fp, ",%lld,%s,%lld,%lld,%.6f,%.6f,%.3f\n", r.pass, r.phase,
+            r.offset, r.bytes, r.elapsed, r.seconds, mbps);
+  }
+  // Records are infrequent, so make each one visible straight away
+  if((ferror(fp) || fflush(fp)) && !error)
+    error = errno;
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Throughput over one window of a target
+struct TraceRecord {
+  std::string path;  // target, copied since it may not outlive the record
+  const char *phase; // "write" or "verify"
+  long long pass;    // pass number, from 0
+  long long offset;  // bytes done at the start of the window
+  long long bytes;   // size of the window
+  double elapsed;    // seconds since the phase started, at the end
+  double seconds;    // time taken by the window
+};
+
+// Writes TraceRecords to a file as CSV or JSON lines. Records go into a
+// fixed-size ring and are written out by a background thread, so recording
+// one never waits for I/O.
+class Trace {
+public:
+  // Write to PATH, as JSON lines if JSON is true or CSV otherwise
+  Trace(const char *path, bool json);
+  ~Trace();
+
+  // Add R to the ring. If the ring is full, R is dropped.
+  void record(const TraceRecord &r);
+
+  // Write out everything recorded and close the file. Fatal on error.
+  void close();
+
+private:
+  std::string path;
+  bool json;
+  FILE *fp;
+  std::vector<TraceRecord> ring;
+  size_t head, tail;  // next to write out, next to fill
+  size_t dropped;     // records lost to a full ring
+  bool stopping;
+  int error;          // errno value from a failed write
+  std::mutex lock;
+  std::condition_variable changed;
+  std::thread writer;
+
+  void run();
+  void write(const TraceRecord &r);
+};
+
+#endif /* TRACE_H */
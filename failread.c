@@ -0,0 +1,78 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LD_PRELOAD shim that fails reads of part of a file with EIO, for testing
+ * read error recovery.
+ *
+ * FAILREAD_PATH     file to fail reads from
+ * FAILREAD_OFFSET   start of the unreadable range
+ * FAILREAD_LENGTH   length of the unreadable range
+ */
+#include <config.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Return nonzero if a read of BYTES at OFFSET in FD should fail */
+static int unreadable(int fd, off_t offset, size_t bytes) {
+  const char *path = getenv("FAILREAD_PATH");
+  struct stat target, sb;
+  off_t start, end;
+
+  if(!path || !bytes)
+    return 0;
+  if(stat(path, &target) < 0 || fstat(fd, &sb) < 0)
+    return 0;
+  if(sb.st_dev != target.st_dev || sb.st_ino != target.st_ino)
+    return 0;
+  start = strtoll(getenv("FAILREAD_OFFSET") ? getenv("FAILREAD_OFFSET") : "0",
+                  NULL, 0);
+  end = start + strtoll(getenv("FAILREAD_LENGTH") ? getenv("FAILREAD_LENGTH")
+                                                  : "0",
+                        NULL, 0);
+  return offset < end && offset + (off_t)bytes > start;
+}
+
+ssize_t read(int fd, void *buffer, size_t bytes) {
+  static ssize_t (*next)(int, void *, size_t);
+  off_t offset;
+
+  if(!next)
+    next = (ssize_t(*)(int, void *, size_t))dlsym(RTLD_NEXT, "read");
+  if((offset = lseek(fd, 0, SEEK_CUR)) >= 0
+     && unreadable(fd, offset, bytes)) {
+    errno = EIO;
+    return -1;
+  }
+  return next(fd, buffer, bytes);
+}
+
+ssize_t pread(int fd, void *buffer, size_t bytes, off_t offset) {
+  static ssize_t (*next)(int, void *, size_t, off_t);
+
+  if(!next)
+    next = (ssize_t(*)(int, void *, size_t, off_t))dlsym(RTLD_NEXT, "pread");
+  if(unreadable(fd, offset, bytes)) {
+    errno = EIO;
+    return -1;
+  }
+  return next(fd, buffer, bytes, offset);
+}
@@ -0,0 +1,241 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "vbig.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <vector>
+#include <algorithm>
+#include "Rng.h"
+
+// Size of each sentinel block (and the granularity of the result)
+#define PROBE_BLOCK 4096
+
+// Result of reading back a sentinel
+enum probe_result { PROBE_GOOD, PROBE_BAD, PROBE_ALIAS };
+
+// State of a capacity probe
+struct Prober {
+  const char *path;
+  int fd;
+  bool direct;          // fd bypasses the cache
+  Rng *rng;
+  std::string seed;
+  uint64_t fingerprint; // fingerprint of seed
+  uint8_t *expected;    // sentinel under construction
+  uint8_t *actual;      // sentinel read back
+  bool reported;        // an alias has been reported
+};
+
+// Construct the sentinel for BLOCK in p.expected. Each sentinel's contents
+// depend only on the seed and its offset, so it is recognizable wherever
+// the device chooses to put it.
+static void sentinel(Prober &p, long long block) {
+  std::string key = p.seed;
+  char suffix[32];
+  snprintf(suffix, sizeof suffix, "@%lld", block * PROBE_BLOCK);
+  key += suffix;
+  p.rng->seed((const uint8_t *)key.data(), key.size());
+  p.rng->stream(p.expected, PROBE_BLOCK);
+  Stamp stamp;
+  stamp.fingerprint = p.fingerprint;
+  stamp.offset = block * PROBE_BLOCK;
+  stamp.pass = 0;
+  write_stamp(p.expected, stamp);
+}
+
+// Write the sentinel for BLOCK. Return false if the device refused it.
+static bool put(Prober &p, long long block) {
+  sentinel(p, block);
+  ssize_t n = pwrite(p.fd, p.expected, PROBE_BLOCK, block * PROBE_BLOCK);
+  if(n == PROBE_BLOCK)
+    return true;
+  if(n < 0 && errno != EIO && errno != ENOSPC && errno != EFBIG)
+    fatal(errno, "write %s", p.path);
+  return false;
+}
+
+// Make sure sentinels have reached the device and that reads will come
+// from it rather than the cache.
+static void settle(Prober &p) {
+  if(fsync(p.fd) < 0)
+    fatal(errno, "fsync %s", p.path);
+#if HAVE_POSIX_FADVISE
+  if(!p.direct)
+    posix_fadvise(p.fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+// Read back the sentinel for BLOCK. If it contains the sentinel written
+// for some other offset, store that offset in FOUND.
+static probe_result check(Prober &p, long long block, long long &found) {
+  ssize_t n = pread(p.fd, p.actual, PROBE_BLOCK, block * PROBE_BLOCK);
+  if(n < 0 && errno != EIO)
+    fatal(errno, "read %s", p.path);
+  if(n != PROBE_BLOCK)
+    return PROBE_BAD;
+  sentinel(p, block);
+  if(!memcmp(p.expected, p.actual, PROBE_BLOCK))
+    return PROBE_GOOD;
+  Stamp stamp;
+  if(read_stamp(p.actual, stamp) && stamp.fingerprint == p.fingerprint
+     && stamp.offset != (uint64_t)block * PROBE_BLOCK) {
+    found = stamp.offset;
+    return PROBE_ALIAS;
+  }
+  return PROBE_BAD;
+}
+
+// Report that data written at one offset turned up at another. Once is
+// enough to make the point.
+static void aliased(Prober &p, long long written, long long block) {
+  if(p.reported)
+    return;
+  p.reported = true;
+  fprintf(stderr, "WARNING: %s: data written at %lld appeared at %lld\n",
+          p.path, written, block * PROBE_BLOCK);
+}
+
+// Find how much of PATH can really be used, by writing sentinels at
+// exponentially spaced offsets and then bisecting between the last good one
+// and the first bad one. ADVERTISED is the claimed size, or 0 to ask the
+// device (in which case it is updated). Returns the usable size in bytes.
+long long probe(const char *path, long long &advertised, Rng *rng,
+                const std::string &seed) {
+  Prober p;
+  p.path = path;
+  p.rng = rng;
+  p.seed = seed;
+  p.fingerprint = seed_fingerprint(seed);
+  p.direct = false;
+  p.reported = false;
+  p.fd = -1;
+#ifdef O_DIRECT
+  p.fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0666);
+  p.direct = p.fd >= 0;
+  if(p.fd < 0 && errno != EINVAL)
+    fatal(errno, "open %s", path);
+#endif
+  if(p.fd < 0 && (p.fd = open(path, O_RDWR | O_CREAT, 0666)) < 0)
+    fatal(errno, "open %s", path);
+#ifdef F_NOCACHE
+  p.direct = fcntl(p.fd, F_NOCACHE, 1) >= 0;
+#endif
+  // O_DIRECT needs aligned buffers
+  void *buffers;
+  if((errno = posix_memalign(&buffers, PROBE_BLOCK, 2 * PROBE_BLOCK)))
+    fatal(errno, "allocate buffers");
+  p.expected = (uint8_t *)buffers;
+  p.actual = p.expected + PROBE_BLOCK;
+  if(!advertised && (advertised = lseek(p.fd, 0, SEEK_END)) < 0)
+    fatal(errno, "lseek %s", path);
+  long long blocks = advertised / PROBE_BLOCK;
+  if(blocks < 1)
+    fatal(0, "%s: too small to probe", path);
+
+  // Sentinels at 0, 1, 2, 4, ... blocks and at the last block
+  std::vector<long long> ladder;
+  ladder.push_back(0);
+  for(long long block = 1; block < blocks - 1; block *= 2)
+    ladder.push_back(block);
+  if(blocks > 1)
+    ladder.push_back(blocks - 1);
+  std::vector<bool> written(ladder.size());
+  for(size_t i = 0; i < ladder.size(); ++i)
+    written[i] = put(p, ladder[i]);
+  settle(p);
+
+  // Work out which sentinel each ladder position returns (or -1 for none).
+  // Positions that return the same sentinel share one real block, so only
+  // the lowest of them is really there.
+  std::vector<long long> seen(ladder.size(), -1);
+  long long found;
+  for(size_t i = 0; i < ladder.size(); ++i) {
+    if(!written[i])
+      continue;
+    switch(check(p, ladder[i], found)) {
+    case PROBE_GOOD: seen[i] = ladder[i]; break;
+    case PROBE_BAD: break;
+    case PROBE_ALIAS:
+      aliased(p, found, ladder[i]);
+      seen[i] = found / PROBE_BLOCK;
+      break;
+    }
+  }
+  long long bad = blocks;
+  for(size_t i = 0; i < ladder.size(); ++i) {
+    bool real = seen[i] >= 0;
+    for(size_t j = 0; j < i && real; ++j)
+      if(seen[j] == seen[i])
+        real = false;
+    if(!real)
+      bad = std::min(bad, ladder[i]);
+  }
+  if(bad == blocks) {
+    close(p.fd);
+    free(buffers);
+    return advertised;
+  }
+  if(bad == 0)
+    fatal(0, "%s: first block does not work", path);
+  // Restore any good sentinels that were overwritten via aliases
+  std::vector<long long> good;
+  for(size_t i = 0; i < ladder.size() && ladder[i] < bad; ++i) {
+    good.push_back(ladder[i]);
+    put(p, ladder[i]);
+  }
+
+  // Bisect. A new sentinel only counts as good if none of the known-good
+  // ones were overwritten by it.
+  settle(p);
+  long long low = good.back();
+  while(bad - low > 1) {
+    long long mid = low + (bad - low) / 2;
+    bool ok = put(p, mid);
+    settle(p);
+    if(ok && check(p, mid, found) != PROBE_GOOD)
+      ok = false;
+    for(size_t i = 0; i < good.size(); ++i) {
+      switch(check(p, good[i], found)) {
+      case PROBE_GOOD: break;
+      case PROBE_ALIAS:
+        if(found == mid * PROBE_BLOCK)
+          aliased(p, found, good[i]);
+        /* fall through */
+      case PROBE_BAD:
+        ok = false;
+        put(p, good[i]);
+        break;
+      }
+    }
+    if(ok) {
+      good.push_back(mid);
+      low = mid;
+    } else {
+      bad = mid;
+      settle(p);
+    }
+  }
+  if(close(p.fd) < 0)
+    fatal(errno, "close %s", path);
+  free(buffers);
+  return bad * PROBE_BLOCK;
+}
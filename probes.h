@@ -0,0 +1,36 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes in the "vbig" provider, for bpftrace, perf, systemtap etc.
+// When nothing is attached each probe is a single nop; if configure didn't
+// find <sys/sdt.h> they compile to nothing at all.
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE2(name, a, b) DTRACE_PROBE2(vbig, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(vbig, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(vbig, name, a, b, c, d)
+#else
+// The arguments still count as used, so there are no warnings.
+#define PROBE2(name, a, b) ((void)(a), (void)(b))
+#define PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#define PROBE4(name, a, b, c, d) ((void)(a), (void)(b), (void)(c), (void)(d))
+#endif
+
+#endif /* PROBES_H */
@@ -0,0 +1,62 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "vbig.h"
+
+// Identifies a stamp: "vbigSTMP" read as a little-endian integer
+static const uint64_t STAMP_MAGIC = 0x504d545367696276ULL;
+
+static void put64(uint8_t *ptr, uint64_t value) {
+  for(int i = 0; i < 8; ++i)
+    ptr[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get64(const uint8_t *ptr) {
+  uint64_t value = 0;
+  for(int i = 0; i < 8; ++i)
+    value |= (uint64_t)ptr[i] << (8 * i);
+  return value;
+}
+
+// Return a 64-bit fingerprint of a seed (FNV-1a)
+uint64_t seed_fingerprint(const std::string &seed) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < seed.size(); ++i) {
+    h ^= (uint8_t)seed[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Write STAMP to the start of BLOCK, which must have room for STAMP_SIZE
+// bytes
+void write_stamp(uint8_t *block, const Stamp &stamp) {
+  put64(block, STAMP_MAGIC);
+  put64(block + 8, stamp.fingerprint);
+  put64(block + 16, stamp.offset);
+  put64(block + 24, stamp.pass);
+}
+
+// Read a stamp from the start of BLOCK. Return false if there isn't one.
+bool read_stamp(const uint8_t *block, Stamp &stamp) {
+  if(get64(block) != STAMP_MAGIC)
+    return false;
+  stamp.fingerprint = get64(block + 8);
+  stamp.offset = get64(block + 16);
+  stamp.pass = get64(block + 24);
+  return true;
+}
@@ -0,0 +1,161 @@
+/*
+ * This file is part of vbig.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "vbig.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#if __linux__
+#include <sys/sysmacros.h>
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <vector>
+#include <fstream>
+
+#if __linux__
+// Split a sysfs path into its components
+static std::vector<std::string> components(const std::string &path) {
+  std::vector<std::string> result;
+  std::string::size_type pos = 0;
+  while(pos < path.size()) {
+    std::string::size_type slash = path.find('/', pos);
+    if(slash == std::string::npos)
+      slash = path.size();
+    if(slash > pos)
+      result.push_back(path.substr(pos, slash - pos));
+    pos = slash + 1;
+  }
+  return result;
+}
+
+// Return true if NAME is a USB device, e.g. 2-1 or 2-1.3
+static bool is_usb_device(const std::string &name) {
+  std::string::size_type dash = name.find('-');
+  if(dash == std::string::npos || dash == 0 || dash + 1 == name.size())
+    return false;
+  for(std::string::size_type i = 0; i < name.size(); ++i)
+    if(!isdigit((unsigned char)name[i]) && name[i] != '.' && i != dash)
+      return false;
+  return true;
+}
+
+// Return true if NAME is a PCI root, e.g. pci0000:00
+static bool is_pci_root(const std::string &name) {
+  return name.compare(0, 3, "pci") == 0;
+}
+
+// Find the shared bottleneck for the device at DEVPATH in sysfs:
+// - devices on USB share the hub they are plugged into
+// - other devices share the PCI root port they are behind, which covers
+//   HBAs with many disks and NVMe devices behind a switch
+// Return an empty string if there isn't one.
+static std::string sysfs_group(const std::string &devpath) {
+  std::vector<std::string> parts = components(devpath);
+  for(size_t i = 0; i < parts.size(); ++i)
+    if(parts[i] == "virtual")
+      return "";
+  for(size_t i = parts.size(); i-- > 1;)
+    if(is_usb_device(parts[i]))
+      return "usb:" + parts[i - 1];
+  for(size_t i = 0; i + 1 < parts.size(); ++i)
+    if(is_pci_root(parts[i]))
+      return "pci:" + parts[i + 1];
+  return "";
+}
+#endif
+
+// Return the name of the group of devices that PATH shares a bottleneck
+// with, e.g. a controller or hub. Ordinary files are grouped according to
+// the device they are stored on.
+std::string device_group(const std::string &path) {
+  struct stat sb;
+  dev_t dev;
+  if(stat(path.c_str(), &sb) == 0)
+    dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+  else {
+    // A file that's yet to be created lives in its parent directory
+    std::string::size_type slash = path.rfind('/');
+    std::string parent = slash == std::string::npos ? "."
+                         : slash == 0               ? "/"
+                                                    : path.substr(0, slash);
+    if(stat(parent.c_str(), &sb) < 0)
+      return path;
+    dev = sb.st_dev;
+  }
+  char name[64];
+#if __linux__
+  snprintf(name, sizeof name, "/sys/dev/block/%u:%u", major(dev), minor(dev));
+  char *devpath = realpath(name, 0);
+  if(devpath) {
+    std::string group = sysfs_group(devpath);
+    free(devpath);
+    if(group.size())
+      return group;
+  }
+#endif
+  snprintf(name, sizeof name, "dev:%u:%u", (unsigned)major(dev),
+           (unsigned)minor(dev));
+  return name;
+}
+
+#if __linux__
+// Return the first line of the sysfs attribute at PATH, without surrounding
+// whitespace, or an empty string if it can't be read.
+static std::string sysfs_attribute(const std::string &path) {
+  std::ifstream f(path.c_str());
+  std::string line;
+  if(!std::getline(f, line))
+    return "";
+  std::string::size_type begin = line.find_first_not_of(" \t");
+  if(begin == std::string::npos)
+    return "";
+  return line.substr(begin, line.find_last_not_of(" \t") + 1 - begin);
+}
+#endif
+
+// Describe PATH and the device it is on, for reports. Anything that can't
+// be found out is left empty.
+DeviceIdentity device_identity(const std::string &path) {
+  DeviceIdentity id;
+  id.group = device_group(path);
+  struct stat sb;
+  if(stat(path.c_str(), &sb) < 0)
+    return id;
+  id.type = S_ISBLK(sb.st_mode)    ? "block device"
+            : S_ISCHR(sb.st_mode)  ? "character device"
+            : S_ISFIFO(sb.st_mode) ? "fifo"
+            : S_ISREG(sb.st_mode)  ? "file"
+                                   : "other";
+  const dev_t dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+  char name[64];
+  snprintf(name, sizeof name, "%u:%u", (unsigned)major(dev),
+           (unsigned)minor(dev));
+  id.device = name;
+#if __linux__
+  std::string disk = std::string("/sys/dev/block/") + name;
+  // Partitions get their identity from the disk they are on
+  struct stat psb;
+  if(stat((disk + "/partition").c_str(), &psb) == 0)
+    disk += "/..";
+  id.model = sysfs_attribute(disk + "/device/model");
+  id.serial = sysfs_attribute(disk + "/device/serial");
+  if(id.serial.empty())
+    id.serial = sysfs_attribute(disk + "/device/wwid");
+#endif
+  return id;
+}
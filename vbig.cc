@@ -28,11 +28,97 @@
 #include <limits.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <cctype>
+#if __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 #include "Arcfour.h"
 #include "CtrDrbg.h"
+#include "BlockOrder.h"
+#include "Histogram.h"
+#include "TokenBucket.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "probes.h"
 
 #define DEFAULT_SEED_LENGTH 256
 
+// Size of each mapping used by --io-mode mmap
+#define MAPPED_WINDOW (64 << 20)
+
+// Size of the blocks visited by --order
+#define ORDER_BLOCK (64 << 10)
+
+// How much is read between cache drops with --scrub
+#define UNCACHED_WINDOW (1 << 20)
+
+// How much --rolling verifies at a time
+#define ROLLING_REGION (16 << 20)
+
+// How long --rate and --iops allow I/O to run ahead, in seconds
+#define THROTTLE_BURST 0.01
+
+// Size and number of the buffers shared between targets by --mirror
+#define MIRROR_BUFFER (1 << 20)
+#define MIRROR_BUFFERS 4
+
+// Long-only options
+enum {
+  OPT_PREALLOCATE = 256,
+  OPT_IO_MODE,
+  OPT_MIRROR,
+  OPT_JOBS,
+  OPT_MAX_JOBS,
+  OPT_GROUP_LIMIT,
+  OPT_PROBE,
+  OPT_STAMP,
+  OPT_IDENTIFY,
+  OPT_KEEP_GOING,
+  OPT_BAD_MAP,
+  OPT_RETRIES,
+  OPT_SKIP_ON_ERROR,
+  OPT_ROLLING,
+  OPT_ORDER,
+  OPT_PASSES,
+  OPT_DURATION,
+  OPT_TRIM,
+  OPT_SCRUB,
+  OPT_INTERVAL,
+  OPT_HISTORY,
+  OPT_RATE,
+  OPT_IOPS,
+  OPT_LATENCY,
+  OPT_BREAKDOWN,
+  OPT_PERF_COUNTERS,
+  OPT_TRACE,
+  OPT_TRACE_WINDOW,
+  OPT_SLOW_THRESHOLD,
+  OPT_SLOW_MAP,
+  OPT_REPORT,
+  OPT_PROGRESS_INTERVAL,
+  OPT_METRICS_FILE,
+};
+
 // Command line options
 const struct option opts[] = {
     {"seed", required_argument, 0, 's'},
@@ -44,8 +130,41 @@ const struct option opts[] = {
     {"flush", no_argument, 0, 'f'},
     {"entire", no_argument, 0, 'e'},
     {"progress", no_argument, 0, 'p'},
+    {"progress-interval", required_argument, 0, OPT_PROGRESS_INTERVAL},
     {"rng", required_argument, 0, 'r'},
     {"force", no_argument, 0, 'F'},
+    {"preallocate", no_argument, 0, OPT_PREALLOCATE},
+    {"io-mode", required_argument, 0, OPT_IO_MODE},
+    {"mirror", no_argument, 0, OPT_MIRROR},
+    {"jobs", required_argument, 0, OPT_JOBS},
+    {"max-jobs", required_argument, 0, OPT_MAX_JOBS},
+    {"group-limit", required_argument, 0, OPT_GROUP_LIMIT},
+    {"probe", no_argument, 0, OPT_PROBE},
+    {"stamp", required_argument, 0, OPT_STAMP},
+    {"identify", no_argument, 0, OPT_IDENTIFY},
+    {"keep-going", no_argument, 0, OPT_KEEP_GOING},
+    {"bad-map", required_argument, 0, OPT_BAD_MAP},
+    {"retries", required_argument, 0, OPT_RETRIES},
+    {"skip-on-error", required_argument, 0, OPT_SKIP_ON_ERROR},
+    {"rolling", required_argument, 0, OPT_ROLLING},
+    {"order", required_argument, 0, OPT_ORDER},
+    {"passes", required_argument, 0, OPT_PASSES},
+    {"duration", required_argument, 0, OPT_DURATION},
+    {"trim", no_argument, 0, OPT_TRIM},
+    {"scrub", required_argument, 0, OPT_SCRUB},
+    {"interval", required_argument, 0, OPT_INTERVAL},
+    {"history", required_argument, 0, OPT_HISTORY},
+    {"rate", required_argument, 0, OPT_RATE},
+    {"iops", required_argument, 0, OPT_IOPS},
+    {"latency", no_argument, 0, OPT_LATENCY},
+    {"breakdown", no_argument, 0, OPT_BREAKDOWN},
+    {"perf-counters", no_argument, 0, OPT_PERF_COUNTERS},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"trace-window", required_argument, 0, OPT_TRACE_WINDOW},
+    {"slow-threshold", required_argument, 0, OPT_SLOW_THRESHOLD},
+    {"slow-map", required_argument, 0, OPT_SLOW_MAP},
+    {"report", required_argument, 0, OPT_REPORT},
+    {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
     {"help", no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
     {0, 0, 0, 0},
@@ -56,13 +175,32 @@ static void help(void) {
   printf("vbig - create or verify a large but pseudo-random file\n"
          "\n"
          "Usage:\n"
-         "  vbig [OPTIONS] [--both|--verify|--create] PATH [SIZE]\n"
+         "  vbig [OPTIONS] [--both|--verify|--create] PATH... [SIZE]\n"
+         "  vbig [OPTIONS] --create - SIZE > OUTPUT\n"
+         "  vbig [OPTIONS] --verify - SIZE < INPUT\n"
+         "  vbig [OPTIONS] --mirror [--both|--verify|--create] PATH... [SIZE]\n"
+         "  vbig [OPTIONS] --jobs FILE [--both|--verify|--create]\n"
+         "  vbig [OPTIONS] --probe PATH [SIZE]\n"
+         "  vbig [OPTIONS] --identify PATH [OFFSET]\n"
+         "  vbig [OPTIONS] --scrub DIR [--interval TIME]\n"
          "\n"
          "Mode selection:\n"
          "  --create, -c      Create PATH with pseudo-random contents\n"
          "  --verify, -v      Verify that PATH contains the expected contents\n"
          "  --both, -b        Do both create and verify (default; implies "
          "--both)\n"
+         "  --rolling LAG     With --both, verify as we go, LAG bytes behind\n"
+         "  --order ORDER     Write/verify in ORDER: "
+         "sequential|reverse|random|stride:N\n"
+         "  --passes N        With --both, write and verify N times\n"
+         "  --duration TIME   With --both, write and verify until TIME "
+         "(s/m/h/d) is up\n"
+         "  --trim            Discard PATH's contents between passes\n"
+         "  --probe           Quickly find how much of PATH is really usable\n"
+         "  --identify        Report which data is at OFFSET of PATH\n"
+         "  --scrub DIR       Verify every file in DIR, in the background\n"
+         "  --interval TIME   With --scrub, repeat every TIME (s/m/h/d)\n"
+         "  --history FILE    With --scrub, append results to FILE\n"
          "\n"
          "Size control:\n"
          "  SIZE[K/M/G]       Size of file or device\n"
@@ -75,36 +213,245 @@ static void help(void) {
          "(bytes)\n"
          "  --rng, -r NAME    Select RNG (arcfour-drop-3072, or "
          "aes-ctr-drbg-128/192/256)\n"
+         "  --stamp UNIT      Start every UNIT (512 or 4K) bytes with its "
+         "offset\n"
          "\n"
          "Other options:\n"
          "  --flush, -f       Flush cache (usually needs root)\n"
          "  --progress, -p    Show progress as we go\n"
+         "  --progress-interval TIME  Time between progress updates\n"
+         "  --latency         Report I/O latency percentiles\n"
+         "  --breakdown       Report where the time went\n"
+         "  --perf-counters   Report CPU counters for generating and comparing\n"
+         "  --trace FILE      Record throughput of each window to FILE\n"
+         "  --trace-window SIZE  Size of each --trace window (default 16M)\n"
+         "  --slow-threshold MS  Report I/Os that take at least MS ms\n"
+         "  --slow-map FILE   Write slow extents to FILE\n"
+         "  --report json[=FILE]  Write a JSON report of the run\n"
+         "  --metrics-file FILE   Keep Prometheus metrics up to date in FILE\n"
+         "  --preallocate     Allocate space for a new file before writing\n"
+         "  --rate SIZE       Limit throughput to SIZE bytes per second\n"
+         "  --iops N          Limit I/O operations to N per second\n"
+         "  --io-mode MODE    Verify using read (default) or mmap\n"
+         "  --keep-going      Verify everything, summarizing bad extents\n"
+         "  --bad-map FILE    Write bad extents to FILE (implies "
+         "--keep-going)\n"
+         "  --retries N       Retry failed reads N times (implies "
+         "--keep-going)\n"
+         "  --skip-on-error SIZE  Skip SIZE after an unreadable block "
+         "(implies --keep-going)\n"
+         "  --mirror          Write/verify the same data to all PATHs at once\n"
          "  --force, -F       Ignore warnings\n"
          "  --help, -h        Display usage message\n"
-         "  --version, -V     Display version string\n");
+         "  --version, -V     Display version string\n"
+         "\n"
+         "Multiple targets:\n"
+         "  --jobs FILE       Read PATH [SIZE] lines from FILE\n"
+         "  --max-jobs N      Run at most N targets at once\n"
+         "  --group-limit N   Run at most N targets per controller or hub\n");
 }
 
 // Possible modes of operation
 enum mode_type { VERIFY, CREATE, BOTH };
 
+// Possible ways of reading the target
+enum io_mode_type { IO_READ, IO_MMAP };
+
+// Granularity of the bad-extent map
+#define BAD_SECTOR 512
+
+// Kinds of bad extent
+enum bad_kind { BAD_CORRUPT, BAD_UNREADABLE, BAD_MISSING, BAD_SKIPPED };
+
+static const char *const bad_kind_names[] = {"corrupt", "unreadable",
+                                             "missing", "skipped"};
+
+// A bad part of a target, found with --keep-going
+struct Extent {
+  long long offset;
+  long long length;
+  bad_kind kind;
+};
+
+// Sectors with at most this many bits wrong count as bit flips rather than
+// zeros, 0xFF or garbage
+#define MAX_BIT_FLIPS 16
+
+// Largest number of unexplained sectors remembered in case they turn out
+// to be aliases
+#define MAX_PENDING (1 << 20)
+
+// Kinds of mismatching sector
+enum mismatch_kind {
+  MISMATCH_ZEROS,    // wrong bytes are all 0
+  MISMATCH_ONES,     // wrong bytes are all 0xFF
+  MISMATCH_BITFLIPS, // a few bits are wrong
+  MISMATCH_ALIASED,  // contains the data for another offset
+  MISMATCH_GARBAGE,  // none of the above
+  MISMATCH_KINDS
+};
+
+static const char *const mismatch_names[] = {"zeros", "0xFF", "bit flips",
+                                             "aliased", "garbage"};
+
+// Classification of the mismatching sectors of a target
+struct Mismatches {
+  long long counts[MISMATCH_KINDS]; // sectors of each kind
+  // Hashes of garbage sectors -> their offsets. If one turns up later in
+  // the expected data then it was really an alias.
+  std::unordered_map<uint64_t, long long> pending;
+  long long aliasAt, aliasOf; // first alias found; aliasAt<0 if none
+
+  Mismatches(): counts(), aliasAt(-1), aliasOf(-1) {}
+};
+
+// Statistics for the chunks of a target that needed recovering
+struct Degraded {
+  long long chunks; // chunks recovered
+  long long bytes;  // bytes in those chunks
+  long long reads;  // reads attempted
+  double seconds;   // time spent recovering
+  double worst;     // slowest read, in seconds
+};
+
+// Most slow extents to list in the output (the rest go only in the map)
+#define SLOW_SHOWN 10
+
+// Seconds between rewrites of the --metrics-file
+#define METRICS_INTERVAL 5
+
+// A range of a target where I/O was slow
+struct SlowExtent {
+  long long offset;
+  long long length;
+  long long count; // number of slow I/Os
+  uint64_t worst;  // slowest of them, in ns
+};
+
+// Where the time went in one phase of a target, in ns, for --breakdown
+struct Breakdown {
+  uint64_t generate; // generating the expected data
+  uint64_t compare;  // comparing it with what was read
+  uint64_t io;       // waiting for reads and writes
+  uint64_t open;     // opening the target
+  uint64_t sync;     // flushing it
+  uint64_t close;    // closing it
+  double started;    // start of the phase, before opening
+  struct rusage usage; // CPU time used at the start of the phase
+
+  Breakdown(): generate(0), compare(0), io(0), open(0), sync(0), close(0),
+               started(0), usage() {}
+};
+
+// One phase of a target, for --report
+struct Phase {
+  long long pass;  // pass number, from 0
+  bool writing;    // write phase (else verify)
+  long long bytes; // bytes written or verified
+  double seconds;  // time taken
+  long long ios;   // reads or writes timed
+  double p50, p90, p99, p999, max; // latency percentiles, in ms
+  long long slow;  // I/Os over --slow-threshold
+};
+
+// A file or device being written or verified
+struct Target {
+  const char *path;
+  std::atomic<long long> size; // expected size (LLONG_MAX if unknown)
+  int fd;                      // open file descriptor
+  std::atomic<long long> done; // bytes written or verified so far
+  std::string error;           // why this target failed, if it did
+  long long errorOffset;       // where the error was found, or -1
+  std::string seed;            // seed for this target's data
+  uint64_t fingerprint;        // fingerprint of seed, for stamps
+  bool entire;                 // write until full/read until EOF
+  double elapsed;              // time taken, in seconds
+  std::vector<Extent> bad;     // bad extents found with --keep-going
+  long long skipFrom;          // start of region to skip (--skip-on-error)
+  long long skipTo;            // end of region to skip
+  std::atomic<double> started; // when the current phase started
+  std::atomic<const char *> activity; // what is happening to it, or null
+  std::atomic<long long> badBytes; // total length of bad extents
+  std::atomic<bool> failed;    // error has been set (safe to read while
+                               // the target is still being worked on)
+  long long chunks;            // chunks verified
+  Degraded degraded;           // chunks that had read errors
+  Mismatches mismatches;       // classification of bad sectors
+  Histogram latency;           // latency of each read/write, in ns
+  Breakdown times;             // where the time went, for --breakdown
+  PerfCounters perfGenerate;   // --perf-counters for generating data
+  PerfCounters perfCompare;    // --perf-counters for comparing it
+  long long operations;        // I/O operations counted by --iops
+  std::vector<SlowExtent> slow; // slow extents found with --slow-threshold
+  std::vector<Phase> phases;   // phases completed, for --report
+  long long traceFrom;         // where the current --trace window started
+  double traceStarted;         // when it started
+
+  Target(const char *path_ = 0):
+      path(path_), size(0), fd(-1), done(0), errorOffset(-1),
+      fingerprint(0), entire(false),
+      elapsed(0), skipFrom(0), skipTo(0), started(0), activity(0),
+      badBytes(0), failed(false), chunks(0), degraded(),
+      mismatches(), operations(0), traceFrom(0), traceStarted(0) {}
+
+  // Copies start with their own --perf-counters, closed
+  Target(const Target &that):
+      path(that.path), size(that.size.load()), fd(that.fd),
+      done(that.done.load()), error(that.error),
+      errorOffset(that.errorOffset), seed(that.seed),
+      fingerprint(that.fingerprint), entire(that.entire),
+      elapsed(that.elapsed), bad(that.bad), skipFrom(that.skipFrom),
+      skipTo(that.skipTo), started(that.started.load()),
+      activity(that.activity.load()), badBytes(that.badBytes.load()),
+      failed(that.failed.load()), chunks(that.chunks),
+      degraded(that.degraded), mismatches(that.mismatches),
+      latency(that.latency), times(that.times), perfGenerate(),
+      perfCompare(), operations(that.operations), slow(that.slow),
+      phases(that.phases), traceFrom(that.traceFrom),
+      traceStarted(that.traceStarted) {}
+};
+
+// Thrown by fatal() in threads working on just one of several targets
+class TargetFailure : public std::runtime_error {
+public:
+  TargetFailure(const std::string &message): std::runtime_error(message) {}
+};
+
+// Set in threads working on just one of several targets. In these threads
+// fatal() throws TargetFailure and the progress indicator isn't used.
+static thread_local bool worker;
+
 static void clearprogress();
+static void writeReport(int status, const std::string &reason);
+static bool writeMetrics(int status);
 
 // Report an error and exit
 void __attribute__((noreturn)) fatal(int errno_value, const char *fmt, ...) {
   va_list ap;
-  clearprogress();
-  fprintf(stderr, "ERROR: ");
+  char buffer[1024];
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
+  vsnprintf(buffer, sizeof buffer, fmt, ap);
   va_end(ap);
+  std::string message = buffer;
   if(errno_value)
-    fprintf(stderr, ": %s", strerror(errno_value));
-  fputc('\n', stderr);
+    message += std::string(": ") + strerror(errno_value);
+  if(worker)
+    throw TargetFailure(message);
+  clearprogress();
+  fprintf(stderr, "ERROR: %s\n", message.c_str());
+  writeReport(1, message);
+  writeMetrics(1);
   exit(1);
 }
 
 // Evict whatever TFD points to from RAM
 static void flushCache(int tfd) {
+  // Pipes, sockets and terminals have no cache to flush
+  struct stat sb;
+  if(fstat(tfd, &sb) < 0)
+    fatal(errno, "fstat");
+  if(!S_ISREG(sb.st_mode) && !S_ISBLK(sb.st_mode))
+    return;
   // drop_caches only evicts clean pages, so first the target file is
   // synced.
   if(fsync(tfd) < 0)
@@ -143,24 +490,178 @@ static void scale(int shift, long long &value) {
   value <<= shift;
 }
 
+// Parse a duration with an optional s, m, h or d suffix. Returns seconds.
+static double parseDuration(const char *arg) {
+  errno = 0;
+  char *end;
+  double value = strtod(arg, &end);
+  if(errno || end == arg || value <= 0 || (*end && end[1]))
+    fatal(0, "invalid duration");
+  switch(*end) {
+  case 0:
+  case 's': break;
+  case 'm': value *= 60; break;
+  case 'h': value *= 3600; break;
+  case 'd': value *= 86400; break;
+  default: fatal(0, "invalid duration");
+  }
+  return value;
+}
+
+// Parse a size, with an optional scale
+static long long parseSize(const char *arg) {
+  errno = 0;
+  char *end;
+  long long value = strtoll(arg, &end, 10);
+  if(errno)
+    fatal(errno, "invalid size");
+  if(end == arg)
+    fatal(0, "invalid size");
+  if(*end) {
+    if(end[1])
+      fatal(0, "invalid scale");
+    scale(*end, value);
+  }
+  return value;
+}
+
+// Return a new RNG called NAME, or a null pointer if there is no such RNG
+static Rng *makeRng(const char *name) {
+  if(!strcasecmp(name, "arcfour"))
+    return new Arcfour();
+  else if(!strcasecmp(name, "arcfour-drop-3072"))
+    return new ArcfourDrop3072();
+  else if(!strcasecmp(name, "aes-ctr-drbg-128"))
+    return new AesCtrDrbg128();
+  else if(!strcasecmp(name, "aes-ctr-drbg-192"))
+    return new AesCtrDrbg192();
+  else if(!strcasecmp(name, "aes-ctr-drbg-256"))
+    return new AesCtrDrbg256();
+  else
+    return 0;
+}
+
 static long long execute(mode_type mode, bool entire, const char *show,
-                         Rng *rng);
+                         Rng *rng, Target &t);
+static long long finish(mode_type mode, Target &t, const char *show);
+static void executeMirror(mode_type mode, bool entire, const char *show,
+                          Rng *rng, std::vector<Target> &targets);
+static void flushoutput();
+static void identifyTarget(const Target &t, long long offset);
+static void executeJobs(mode_type mode, const char *rngname,
+                        std::vector<Target> &targets);
+static long long executeRolling(bool entire, const char *show,
+                                const char *rngname, Target &t);
+static long long executeOrdered(mode_type mode, bool entire, const char *show,
+                                Rng *rng, Target &t);
+static void executeBurnin(bool entire, Rng *rng, Target &t);
+static void startStatus();
+static void metricsThread();
+static int executeScrub(Rng *rng);
 
 static const char default_seed[] = "hexapodia as the key insight";
 static void *seed;
 static size_t seedlen;
 static const char *seedpath;
-static const char *path;
 static bool entireopt = false;
+static const char *jobfile;
+static int max_jobs = 0;     // most jobs to run at once; 0 for no limit
+static int group_limit = -1; // most jobs per group; 0 for no limit
 static bool flush = false;
 static bool progress = false;
-static long long size;
+static double progress_interval = 1; // seconds between progress updates
+static bool latency = false;    // report latency percentiles
+static bool breakdown = false;  // report where the time went
+static bool perf_counters = false; // report hardware performance counters
+static bool mirror = false;     // generate once for all targets
+static const char *trace_path;  // where to write --trace records
+static Trace *trace;            // --trace writer
+static long long trace_window = 16 << 20; // bytes per --trace record
+static uint64_t slow_threshold = UINT64_MAX; // ns for an I/O to count as slow
+static FILE *slow_map;          // where to write slow extents
+static bool report = false;     // write a JSON report
+static FILE *report_file;       // where to write it (if not stdout)
+static const char *report_path; // its name
+static bool reporting = false;  // the report is being written
+static std::vector<Target> *report_targets; // targets to report on
+static const char *report_rng;  // RNG name, for the report
+static const char *report_mode; // mode, for the report
+static const char *metrics_path; // where to write Prometheus metrics
+static bool preallocate = false;
+static io_mode_type io_mode = IO_READ;
+static bool streaming = false; // PATH is -
+static size_t stamp_unit = 0;  // bytes per stamp; 0 for unstamped data
+static std::atomic<uint64_t> pass(0); // pass number recorded in stamps
+static bool keep_going = false; // record bad extents rather than stopping
+static FILE *bad_map;           // where to write bad extents
+static int retries = 0;         // extra attempts at failed reads
+static long long skip_on_error = 0; // bytes to skip after an unreadable block
+static long long rolling_lag = -1;  // how far verification lags; -1 for none
+static bool ordered = false;        // visit blocks in order_kind order
+static BlockOrder::Kind order_kind = BlockOrder::SEQUENTIAL;
+static long long order_stride = 1; // block stride for --order stride:N
+static long long passes = 0;   // number of passes to make; 0 for no limit
+static double duration = 0;    // seconds to keep making passes; 0 for none
+static bool trim = false;      // discard contents between passes
+static const char *scrub_dir;  // directory of canary files to scrub
+static double scrub_interval = 0; // seconds between scrubs; 0 for once only
+static const char *history;    // where to append scrub results
+static bool uncached = false;  // drop data from the cache once verified
+static long long rate_limit = 0; // most bytes per second; 0 for no limit
+static long long iops_limit = 0; // most operations per second; 0 for none
+static bool throttled = false;   // --rate or --iops in force
+static TokenBucket byte_bucket;  // shared by all targets for --rate
+static TokenBucket io_bucket;    // shared by all targets for --iops
+static FILE *output = stdout;  // where messages go
+static std::mutex output_lock; // serializes messages and the bad extent map
+
+// Read a job file for --jobs. Each line is PATH [SIZE]; blank lines and
+// lines starting with # are ignored.
+static void readJobs(const char *jobfile, mode_type mode,
+                     std::vector<Target> &targets,
+                     std::vector<const char *> &sizeargs) {
+  FILE *fp = fopen(jobfile, "r");
+  if(!fp)
+    fatal(errno, "open %s", jobfile);
+  char line[4096];
+  int lineno = 0;
+  while(fgets(line, sizeof line, fp)) {
+    ++lineno;
+    const char *fields[3];
+    int nfields = 0;
+    for(char *field = strtok(line, " \t\r\n"); field && nfields < 3;
+        field = strtok(0, " \t\r\n"))
+      fields[nfields++] = field;
+    if(nfields == 0 || fields[0][0] == '#')
+      continue;
+    if(nfields > 2)
+      fatal(0, "%s:%d: excess arguments", jobfile, lineno);
+    const char *sizearg = nfields > 1 ? strdup(fields[1]) : 0;
+    Target t(strdup(fields[0]));
+    /* As on the command line, --both without a size fills the target */
+    t.entire = entireopt || (!sizearg && mode == BOTH);
+    if(entireopt && sizearg)
+      fatal(0, "%s:%d: with --entire, size should not be specified", jobfile,
+            lineno);
+    if(!t.entire && !sizearg && mode != VERIFY)
+      fatal(0, "%s:%d: size must be specified", jobfile, lineno);
+    targets.push_back(t);
+    sizeargs.push_back(sizearg);
+  }
+  if(ferror(fp))
+    fatal(errno, "read %s", jobfile);
+  fclose(fp);
+  if(targets.empty())
+    fatal(0, "%s: no jobs", jobfile);
+}
 
 int main(int argc, char **argv) {
   mode_type mode = BOTH;
   int n;
   char *ep;
   bool force = false;
+  bool probing = false;
+  bool identify = false;
   const char *rngname = "aes-ctr-drbg-128";
   while((n = getopt_long(argc, argv, "+s:S:L:bvcepfhV", opts, 0)) >= 0) {
     switch(n) {
@@ -179,46 +680,201 @@ int main(int argc, char **argv) {
     case 'c': mode = CREATE; break;
     case 'e': entireopt = true; break;
     case 'p': progress = true; break;
+    case OPT_PROGRESS_INTERVAL:
+      progress_interval = parseDuration(optarg);
+      break;
     case 'f': flush = true; break;
     case 'r': rngname = optarg; break;
     case 'h': help(); exit(0);
     case 'V': puts(VERSION " " TAG); exit(0);
     case 'F': force = true; break;
+    case OPT_PREALLOCATE: preallocate = true; break;
+    case OPT_MIRROR: mirror = true; break;
+    case OPT_PROBE:
+      probing = true;
+      mode = BOTH;
+      break;
+    case OPT_KEEP_GOING: keep_going = true; break;
+    case OPT_BAD_MAP:
+      keep_going = true;
+      if(!(bad_map = fopen(optarg, "w")))
+        fatal(errno, "open %s", optarg);
+      fprintf(bad_map, "# OFFSET LENGTH KIND PATH\n");
+      break;
+    case OPT_RETRIES:
+      keep_going = true;
+      retries = strtol(optarg, &ep, 0);
+      if(ep == optarg || *ep || retries < 0)
+        fatal(0, "bad number for --retries");
+      break;
+    case OPT_SKIP_ON_ERROR:
+      keep_going = true;
+      skip_on_error = parseSize(optarg);
+      break;
+    case OPT_ROLLING: rolling_lag = parseSize(optarg); break;
+    case OPT_PASSES:
+      passes = strtoll(optarg, &ep, 0);
+      if(ep == optarg || *ep || passes < 1)
+        fatal(0, "bad number for --passes");
+      break;
+    case OPT_DURATION: duration = parseDuration(optarg); break;
+    case OPT_TRIM: trim = true; break;
+    case OPT_SCRUB:
+      scrub_dir = optarg;
+      mode = VERIFY;
+      break;
+    case OPT_INTERVAL: scrub_interval = parseDuration(optarg); break;
+    case OPT_HISTORY: history = optarg; break;
+    case OPT_RATE:
+      if((rate_limit = parseSize(optarg)) < 1)
+        fatal(0, "invalid size for --rate");
+      break;
+    case OPT_LATENCY: latency = true; break;
+    case OPT_BREAKDOWN: breakdown = true; break;
+    case OPT_PERF_COUNTERS: perf_counters = true; break;
+    case OPT_TRACE: trace_path = optarg; break;
+    case OPT_SLOW_THRESHOLD: {
+      const double ms = strtod(optarg, &ep);
+      if(ep == optarg || *ep || ms <= 0)
+        fatal(0, "bad number for --slow-threshold");
+      slow_threshold = ms * 1e6;
+      break;
+    }
+    case OPT_REPORT:
+      report = true;
+      if(!strncmp(optarg, "json=", 5)) {
+        report_path = optarg + 5;
+        if(!(report_file = fopen(report_path, "w")))
+          fatal(errno, "open %s", report_path);
+      } else if(strcmp(optarg, "json"))
+        fatal(0, "unrecognized report format '%s'", optarg);
+      break;
+    case OPT_METRICS_FILE: metrics_path = optarg; break;
+    case OPT_SLOW_MAP:
+      if(!(slow_map = fopen(optarg, "w")))
+        fatal(errno, "open %s", optarg);
+      fprintf(slow_map, "# OFFSET LENGTH IOS WORST_MS PHASE PATH\n");
+      break;
+    case OPT_TRACE_WINDOW:
+      if((trace_window = parseSize(optarg)) < 1)
+        fatal(0, "invalid size for --trace-window");
+      break;
+    case OPT_IOPS:
+      iops_limit = strtoll(optarg, &ep, 0);
+      if(ep == optarg || *ep || iops_limit < 1)
+        fatal(0, "bad number for --iops");
+      break;
+    case OPT_ORDER:
+      ordered = true;
+      if(!strcmp(optarg, "sequential"))
+        order_kind = BlockOrder::SEQUENTIAL;
+      else if(!strcmp(optarg, "reverse"))
+        order_kind = BlockOrder::REVERSE;
+      else if(!strcmp(optarg, "random"))
+        order_kind = BlockOrder::RANDOM;
+      else if(!strncmp(optarg, "stride:", 7)) {
+        order_kind = BlockOrder::STRIDE;
+        order_stride = strtoll(optarg + 7, &ep, 0);
+        if(ep == optarg + 7 || *ep || order_stride < 1)
+          fatal(0, "bad number for --order stride");
+      } else
+        fatal(0, "unrecognized order '%s'", optarg);
+      break;
+    case OPT_IDENTIFY:
+      identify = true;
+      mode = VERIFY;
+      break;
+    case OPT_STAMP:
+      stamp_unit = parseSize(optarg);
+      if(stamp_unit != 512 && stamp_unit != 4096)
+        fatal(0, "--stamp must be 512 or 4K");
+      break;
+    case OPT_JOBS: jobfile = optarg; break;
+    case OPT_MAX_JOBS:
+      max_jobs = strtol(optarg, &ep, 0);
+      if(ep == optarg || *ep || max_jobs < 0)
+        fatal(0, "bad number for --max-jobs");
+      break;
+    case OPT_GROUP_LIMIT:
+      group_limit = strtol(optarg, &ep, 0);
+      if(ep == optarg || *ep || group_limit < 0)
+        fatal(0, "bad number for --group-limit");
+      break;
+    case OPT_IO_MODE:
+      if(!strcmp(optarg, "read"))
+        io_mode = IO_READ;
+      else if(!strcmp(optarg, "mmap"))
+        io_mode = IO_MMAP;
+      else
+        fatal(0, "unrecognized I/O mode '%s'", optarg);
+      break;
     default: fatal(0, "unknown option");
     }
   }
   argc -= optind;
   argv += optind;
-  Rng *rng;
+  byte_bucket.configure(rate_limit, THROTTLE_BURST);
+  io_bucket.configure(iops_limit, THROTTLE_BURST);
+  throttled = rate_limit || iops_limit;
+  Rng *rng = makeRng(rngname);
+  if(!rng)
+    fatal(0, "unrecognized RNG '%s'", rngname);
   if(!strcasecmp(rngname, "arcfour")) {
     if(mode != VERIFY)
       fatal(0, "arcfour algorithm is insecure");
     fprintf(stderr, "WARNING: arcfour algorithm is insecure\n");
-    rng = new Arcfour();
-  } else if(!strcasecmp(rngname, "arcfour-drop-3072"))
-    rng = new ArcfourDrop3072();
-  else if(!strcasecmp(rngname, "aes-ctr-drbg-128"))
-    rng = new AesCtrDrbg128();
-  else if(!strcasecmp(rngname, "aes-ctr-drbg-192"))
-    rng = new AesCtrDrbg192();
-  else if(!strcasecmp(rngname, "aes-ctr-drbg-256"))
-    rng = new AesCtrDrbg256();
-  else
-    fatal(0, "unrecognized RNG '%s'", rngname);
-  /* expect PATH [SIZE] */
-  if(argc > 2)
-    fatal(0, "excess arguments");
-  /* If --both but no SIZE, assume a block device, which is to be filled */
-  if(argc == 1 && mode == BOTH)
-    entireopt = true;
-  if(entireopt) {
-    if(argc != 1)
-      fatal(0, "with --entire, size should not be specified");
+  }
+  std::vector<Target> targets;
+  std::vector<const char *> sizeargs;
+  if(jobfile) {
+    if(argc > 0)
+      fatal(0, "PATH cannot be used with --jobs");
+    if(mirror)
+      fatal(0, "--mirror cannot be used with --jobs");
+    if(probing || identify || scrub_dir)
+      fatal(0, "--probe, --identify and --scrub cannot be used with --jobs");
+    readJobs(jobfile, mode, targets, sizeargs);
+    for(size_t i = 0; i < targets.size(); ++i)
+      if(!strcmp(targets[i].path, "-"))
+        fatal(0, "- cannot be used with --jobs");
+    /* Don't oversubscribe controllers unless asked to */
+    if(group_limit < 0)
+      group_limit = 1;
+  } else if(scrub_dir) {
+    /* The files to verify are found when scrubbing */
+    if(argc > 0)
+      fatal(0, "PATH cannot be used with --scrub");
+    if(mirror || probing || identify || entireopt)
+      fatal(0, "--scrub cannot be used with --mirror, --probe, --identify or "
+               "--entire");
   } else {
-    /* --create without --entire requires PATH SIZE
-     * --verify just requires PATH, SIZE is optional */
-    if(argc < (mode == VERIFY ? 1 : 2))
-      fatal(0, "insufficient arguments");
+    /* expect PATH... [SIZE]; a final argument that starts with a digit is
+     * the size */
+    int npaths = argc;
+    const char *sizearg = 0;
+    if(argc > 1 && isdigit((unsigned char)argv[argc - 1][0]))
+      sizearg = argv[--npaths];
+    /* If --both but no SIZE, assume a block device, which is to be filled */
+    if(npaths >= 1 && !sizearg && mode == BOTH && !probing)
+      entireopt = true;
+    if(probing || identify) {
+      /* --probe and --identify take one PATH and an optional number */
+      if(npaths != 1 || entireopt || mirror)
+        fatal(0, "--probe and --identify take a single PATH");
+    } else if(entireopt) {
+      if(npaths < 1 || sizearg)
+        fatal(0, "with --entire, size should not be specified");
+    } else {
+      /* --create without --entire requires PATH SIZE
+       * --verify just requires PATH, SIZE is optional */
+      if(npaths < 1 || (mode != VERIFY && !sizearg))
+        fatal(0, "insufficient arguments");
+    }
+    for(int i = 0; i < npaths; ++i) {
+      targets.push_back(Target(argv[i]));
+      targets.back().entire = entireopt;
+      sizeargs.push_back(sizearg);
+    }
   }
   if(seed && seedpath)
     fatal(0, "both --seed and --seed-file specified");
@@ -231,11 +887,57 @@ int main(int argc, char **argv) {
              " and random device not supported on this system");
 #endif
   }
-  path = argv[0];
-  if(mode != VERIFY) {
-    if(!safe_path(path) && !force) {
-      fatal(0, "use --force to override warnings");
-      exit(1);
+  if(rolling_lag >= 0 && (mode != BOTH || mirror || probing))
+    fatal(0, "--rolling can only be used with --both");
+  if(ordered && (mirror || probing || identify || rolling_lag >= 0))
+    fatal(0, "--order cannot be used with --mirror, --probe, --identify or "
+             "--rolling");
+  const bool burnin = passes || duration;
+  if(burnin && (mode != BOTH || mirror || probing || jobfile
+                || targets.size() > 1 || rolling_lag >= 0))
+    fatal(0, "--passes and --duration need --both and a single PATH");
+  if(report && scrub_dir)
+    fatal(0, "--report cannot be used with --scrub");
+  report_targets = &targets;
+  report_rng = rngname;
+  report_mode = mode == VERIFY ? "verify" : mode == CREATE ? "create" : "both";
+  if(slow_map && slow_threshold == UINT64_MAX)
+    fatal(0, "--slow-map needs --slow-threshold");
+  if(trim && !burnin)
+    fatal(0, "--trim can only be used with --passes or --duration");
+  if((scrub_interval || history) && !scrub_dir)
+    fatal(0, "--interval and --history can only be used with --scrub");
+  if(ordered && io_mode == IO_MMAP)
+    fatal(0, "--order cannot be used with --io-mode mmap");
+  if(!targets.empty() && !strcmp(targets[0].path, "-")) {
+    // Create to stdout or verify from stdin
+    if(mode == BOTH)
+      fatal(0, "- can only be used with --create or --verify");
+    if(ordered)
+      fatal(0, "- cannot be used with --order");
+    streaming = true;
+    if(mode == CREATE) {
+      if(report && !report_file)
+        fatal(0, "--report json needs a FILE when creating to -");
+      targets[0].path = "stdout";
+      output = stderr;
+      // With --entire, write until the reader goes away.
+      if(entireopt)
+        signal(SIGPIPE, SIG_IGN);
+    } else
+      targets[0].path = "stdin";
+  }
+  // A report on stdout gets it to itself
+  if(report && !report_file)
+    output = stderr;
+  for(size_t i = 0; i < targets.size(); ++i) {
+    if(targets.size() > 1 && !strcmp(targets[i].path, "-"))
+      fatal(0, "- cannot be used with more than one PATH");
+    if(mode != VERIFY && !streaming) {
+      if(!safe_path(targets[i].path) && !force) {
+        fatal(0, "use --force to override warnings");
+        exit(1);
+      }
     }
   }
   if(seedpath) {
@@ -257,76 +959,251 @@ int main(int argc, char **argv) {
     seed = (void *)default_seed;
     seedlen = sizeof(default_seed) - 1;
   }
-  if(argc > 1) {
-    /* Explicit size specified */
-    errno = 0;
-    char *end;
-    size = strtoll(argv[1], &end, 10);
-    if(errno)
-      fatal(errno, "invalid size");
-    if(end == argv[1])
-      fatal(0, "invalid size");
-    if(*end) {
-      if(end[1])
-        fatal(0, "invalid scale");
-      scale(*end, size);
-    }
-  } else if(entireopt) {
-    /* Use stupidly large size as a proxy for 'infinite' */
-    size = LLONG_MAX;
-  } else {
-    /* Retrieve size from target (which must exist) */
-    struct stat sb;
-    if(stat(path, &sb) < 0)
-      fatal(errno, "stat %s", path);
-    size = sb.st_size;
+  for(size_t i = 0; i < targets.size(); ++i) {
+    Target &t = targets[i];
+    t.seed.assign((const char *)seed, seedlen);
+    if((targets.size() > 1 || jobfile) && !mirror) {
+      /* Independent targets get independent data */
+      char suffix[32];
+      snprintf(suffix, sizeof suffix, "/%zu", i + 1);
+      t.seed += suffix;
+    }
+    t.fingerprint = seed_fingerprint(t.seed);
+    if(sizeargs[i]) {
+      /* Explicit size specified */
+      t.size = parseSize(sizeargs[i]);
+    } else if(t.entire) {
+      /* Use stupidly large size as a proxy for 'infinite' */
+      t.size = LLONG_MAX;
+    } else {
+      /* Retrieve size from target (which must exist) */
+      struct stat sb;
+      if(streaming) {
+        if(fstat(0, &sb) < 0)
+          fatal(errno, "fstat %s", t.path);
+        if(!S_ISREG(sb.st_mode))
+          fatal(0, "%s: size must be specified", t.path);
+      } else if(stat(t.path, &sb) < 0)
+        fatal(errno, "stat %s", t.path);
+      t.size = sb.st_size;
+    }
   }
   const char *show = entireopt ? (mode == CREATE ? "written" : "verified") : 0;
-  if(mode == BOTH) {
-    size = execute(CREATE, entireopt, 0, rng);
-    execute(VERIFY, false, show, rng);
+  int status = 0;
+  // Before any other threads start, so that they inherit the signal mask
+  startStatus();
+  if(metrics_path) {
+    if(!writeMetrics(-1))
+      fatal(errno, "write %s", metrics_path);
+    std::thread(metricsThread).detach();
+  }
+  if(trace_path) {
+    /* JSON lines if the name says so, otherwise CSV */
+    const size_t len = strlen(trace_path);
+    const bool json = (len >= 5 && !strcmp(trace_path + len - 5, ".json"))
+                      || (len >= 6 && !strcmp(trace_path + len - 6, ".jsonl"));
+    trace = new Trace(trace_path, json);
+  }
+  if(probing) {
+    Target &t = targets[0];
+    long long advertised = t.size;
+    const long long usable = probe(t.path, advertised, rng, t.seed);
+    t.size = advertised;
+    fprintf(output, "%lld bytes (%lldM, %lldG) usable\n", usable,
+            usable >> 20, usable >> 30);
+    flushoutput();
+    if(usable < t.size)
+      fatal(0, "%s: only %lld/%lld bytes usable", t.path, usable, t.size.load());
+  } else if(identify) {
+    /* The number is an offset rather than a size */
+    identifyTarget(targets[0], sizeargs[0] ? targets[0].size.load() : 0);
+  } else if(mirror) {
+    if(mode == BOTH) {
+      executeMirror(CREATE, entireopt, 0, rng, targets);
+      for(size_t i = 0; i < targets.size(); ++i)
+        targets[i].size = targets[i].done.load();
+      executeMirror(VERIFY, false, show, rng, targets);
+    } else
+      executeMirror(mode, entireopt, show, rng, targets);
+    for(size_t i = 0; i < targets.size(); ++i)
+      if(!targets[i].error.empty())
+        status = 1;
+  } else if(targets.size() > 1 || jobfile) {
+    /* Even a single job gets its own size handling and the summary */
+    executeJobs(mode, rngname, targets);
+    for(size_t i = 0; i < targets.size(); ++i)
+      if(!targets[i].error.empty())
+        status = 1;
+  } else if(scrub_dir) {
+    status = executeScrub(rng);
+  } else if(burnin) {
+    executeBurnin(entireopt, rng, targets[0]);
+  } else if(mode == BOTH && rolling_lag >= 0) {
+    executeRolling(entireopt, show, rngname, targets[0]);
+  } else if(mode == BOTH) {
+    targets[0].size = execute(CREATE, entireopt, 0, rng, targets[0]);
+    execute(VERIFY, false, show, rng, targets[0]);
   } else {
-    execute(mode, entireopt, show, rng);
+    execute(mode, entireopt, show, rng, targets[0]);
   }
   delete rng; /* placate memory leak checkers */
-  return 0;
-}
-
-// flush stdout, fatal on error
-static void flushstdout() {
-  if(ferror(stdout) || fflush(stdout))
-    fatal(errno, "flush stdout");
+  if(trace) {
+    trace->close();
+    delete trace;
+  }
+  if(bad_map && (ferror(bad_map) || fclose(bad_map) < 0))
+    fatal(errno, "write bad extent map");
+  if(slow_map && (ferror(slow_map) || fclose(slow_map) < 0))
+    fatal(errno, "write slow extent map");
+  writeReport(status, status ? "one or more targets failed" : "ok");
+  if(metrics_path && !writeMetrics(status))
+    fatal(errno, "write %s", metrics_path);
+  return status;
 }
 
-// clear the progress indicator
-static void clearprogress() {
-  if(!progress)
-    return;
-  printf(" %-10s %*s   \r", "", (int)sizeof(long long) * 4, "");
-  flushstdout();
+// flush the message stream, fatal on error
+static void flushoutput() {
+  if(ferror(output) || fflush(output))
+    fatal(errno, "flush %s", output == stdout ? "stdout" : "stderr");
 }
 
-// update progress indicator
-static void showprogress(long long amount, const char *show, bool force) {
-  if(!progress)
-    return;
-
-  static int counter;
-  if(counter++ < 1000 && !force)
-    return;
-  counter = 0;
+// Width of an amount formatted by formatAmount()
+#define AMOUNT_WIDTH (sizeof(long long) * 4)
 
+// Format AMOUNT with digits in groups of three
+static void formatAmount(char outbuf[AMOUNT_WIDTH + 1], long long amount) {
   const size_t triples = sizeof(amount);
   char rawbuf[triples * 3 + 1];
-  char outbuf[triples * 4 + 1];
   snprintf(rawbuf, sizeof(rawbuf), "% *lld", (int)sizeof(rawbuf) - 1, amount);
   for(size_t i = 0; i < triples; i++) {
     outbuf[i * 4] = ' ';
     memcpy(outbuf + i * 4 + 1, rawbuf + i * 3, 3);
   }
   outbuf[triples * 4] = 0;
-  printf(" %-10s %s...\r", outbuf, show);
-  flushstdout();
+}
+
+// Return the current monotonic time in seconds
+static double now() {
+  struct timespec ts;
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    fatal(errno, "clock_gettime");
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Progress indicator state. The I/O loop only records how far it has got;
+// a separate thread redraws the indicator every --progress-interval.
+static std::atomic<long long> progress_amount; // bytes done in this phase
+static std::atomic<const char *> progress_label; // what is being done
+static std::mutex progress_lock;  // serializes drawing; guards the rest
+static bool progress_running;     // the drawing thread has been started
+static long long progress_total;  // expected bytes, or 0 if unknown
+static double progress_started;   // when this phase started
+static long long progress_last;   // amount at the previous update
+static double progress_when;      // time of the previous update
+static long long progress_cleared = -1; // amount when last cleared
+static int progress_width;        // width of the indicator, if shown
+
+// Format SECONDS as [H:]MM:SS
+static std::string formatEta(double seconds) {
+  const long long s = seconds + 0.5;
+  char buffer[64];
+  if(s >= 3600)
+    snprintf(buffer, sizeof buffer, "%lld:%02lld:%02lld", s / 3600,
+             s / 60 % 60, s % 60);
+  else
+    snprintf(buffer, sizeof buffer, "%02lld:%02lld", s / 60, s % 60);
+  return buffer;
+}
+
+// Draw LINE as the progress indicator. Call with progress_lock held.
+static void drawprogress(const char *line) {
+  const int width = strlen(line);
+  fprintf(output, "%s%*s\r", line,
+          progress_width > width ? progress_width - width : 0, "");
+  progress_width = width;
+  // Errors are picked up by the next flushoutput(); fatal() would deadlock
+  // here.
+  fflush(output);
+}
+
+// Redraw the progress indicator. Call with progress_lock held.
+static void updateprogress() {
+  const long long amount = progress_amount.load(std::memory_order_relaxed);
+  const char *label = progress_label.load(std::memory_order_relaxed);
+  // Nothing to say if nothing has happened since the indicator was cleared
+  if(!label || amount == progress_cleared)
+    return;
+  const double when = now();
+  const double elapsed = when - progress_started;
+  const double current = when > progress_when
+                             ? (amount - progress_last) / (when - progress_when)
+                             : 0;
+  progress_last = amount;
+  progress_when = when;
+  char outbuf[AMOUNT_WIDTH + 1];
+  formatAmount(outbuf, amount);
+  char line[256];
+  int n = snprintf(line, sizeof line, " %-10s %s... %.1f MB/s (average %.1f MB/s)",
+                   outbuf, label, current / 1e6,
+                   elapsed > 0 ? amount / elapsed / 1e6 : 0.0);
+  if(progress_total > 0 && amount <= progress_total && amount > 0)
+    snprintf(line + n, sizeof line - n, ", %.1f%%, ETA %s",
+             100.0 * amount / progress_total,
+             formatEta((progress_total - amount) * elapsed / amount).c_str());
+  drawprogress(line);
+}
+
+// Redraw the progress indicator every --progress-interval, for ever.
+static void progressThread() {
+  for(;;) {
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(progress_interval));
+    std::lock_guard<std::mutex> guard(progress_lock);
+    updateprogress();
+  }
+}
+
+// Start a new phase of the progress indicator, expecting TOTAL bytes (or 0
+// if unknown).
+static void startprogress(long long total) {
+  if(!progress || worker)
+    return;
+  std::lock_guard<std::mutex> guard(progress_lock);
+  progress_total = total;
+  progress_started = progress_when = now();
+  progress_last = 0;
+  progress_amount.store(0, std::memory_order_relaxed);
+  // The thread runs until exit, so that fatal() needn't stop it.
+  if(!progress_running) {
+    std::thread(progressThread).detach();
+    progress_running = true;
+  }
+}
+
+// clear the progress indicator
+static void clearprogress() {
+  if(!progress || worker)
+    return;
+  std::lock_guard<std::mutex> guard(progress_lock);
+  if(progress_width) {
+    fprintf(output, "%*s\r", progress_width, "");
+    progress_width = 0;
+    fflush(output);
+  }
+  progress_cleared = progress_amount.load(std::memory_order_relaxed);
+}
+
+// update progress indicator. This is called for every chunk, so it just
+// records AMOUNT; with FORCE the indicator is redrawn at once.
+static void showprogress(long long amount, const char *show, bool force) {
+  if(!progress || worker)
+    return;
+  progress_amount.store(amount, std::memory_order_relaxed);
+  progress_label.store(show, std::memory_order_relaxed);
+  if(force) {
+    std::lock_guard<std::mutex> guard(progress_lock);
+    updateprogress();
+  }
 }
 
 // Equivalent to write() but handles short writes and EINTR
@@ -372,88 +1249,2239 @@ static ssize_t readall(int fd, uint8_t *buffer, size_t bytes) {
   return total;
 }
 
+// Return the monotonic clock in nanoseconds, for timing individual I/Os
+static uint64_t nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Format the latency percentiles in H for display
+static std::string formatLatency(const Histogram &h) {
+  char buffer[128];
+  snprintf(buffer, sizeof buffer,
+           "p50 %.3fms, p90 %.3fms, p99 %.3fms, p99.9 %.3fms, max %.3fms",
+           h.percentile(0.5) / 1e6, h.percentile(0.9) / 1e6,
+           h.percentile(0.99) / 1e6, h.percentile(0.999) / 1e6,
+           h.max() / 1e6);
+  return buffer;
+}
+
+// Record the phase of T that has just finished, for --report.
+static void recordPhase(Target &t, bool writing) {
+  Phase p;
+  p.pass = pass;
+  p.writing = writing;
+  p.bytes = t.done;
+  p.seconds = now() - t.started;
+  p.ios = t.latency.count();
+  p.p50 = t.latency.percentile(0.5) / 1e6;
+  p.p90 = t.latency.percentile(0.9) / 1e6;
+  p.p99 = t.latency.percentile(0.99) / 1e6;
+  p.p999 = t.latency.percentile(0.999) / 1e6;
+  p.max = t.latency.max() / 1e6;
+  p.slow = 0;
+  for(size_t i = 0; i < t.slow.size(); ++i)
+    p.slow += t.slow[i].count;
+  t.phases.push_back(p);
+  t.activity = nullptr;
+  PROBE4(phase__done, t.path, writing ? "write" : "verify", pass, p.bytes);
+}
+
+// Report the latency of T's I/O in the phase that has just finished.
+static void reportLatency(const Target &t, bool writing) {
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  if(t.latency.count())
+    fprintf(output, "%s: %s latency %s over %llu I/O%s\n", t.path,
+            writing ? "write" : "read", formatLatency(t.latency).c_str(),
+            (unsigned long long)t.latency.count(),
+            t.latency.count() == 1 ? "" : "s");
+  else
+    fprintf(output, "%s: no %s latency recorded\n", t.path,
+            writing ? "write" : "read");
+  flushoutput();
+}
+
+// Get the CPU time used by the calling thread (or, where that isn't
+// available, the whole process) into USAGE.
+static void threadUsage(struct rusage &usage) {
+#ifdef RUSAGE_THREAD
+  if(getrusage(RUSAGE_THREAD, &usage) < 0)
+#else
+  if(getrusage(RUSAGE_SELF, &usage) < 0)
+#endif
+    fatal(errno, "getrusage");
+}
+
+// Return the seconds between timevals A and B
+static double timevalSeconds(const struct timeval &a,
+                             const struct timeval &b) {
+  return (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1e6;
+}
+
+// Report where the time went in the phase of T that has just finished, and
+// what seems to have limited it.
+static void reportBreakdown(const Target &t, bool writing) {
+  const Breakdown &b = t.times;
+  struct rusage usage;
+  threadUsage(usage);
+  const double user = timevalSeconds(b.usage.ru_utime, usage.ru_utime);
+  const double system = timevalSeconds(b.usage.ru_stime, usage.ru_stime);
+  const double wall = now() - b.started;
+  const double device = (b.io + b.open + b.sync + b.close) / 1e9;
+  const double accounted = device + (b.generate + b.compare) / 1e9;
+  const double other = wall > accounted ? wall - accounted : 0;
+  // The biggest of these is the bottleneck
+  const struct {
+    const char *what;
+    double seconds;
+  } causes[] = {
+      {"device", device},
+      {"CPU (generating data)", b.generate / 1e9},
+      {"CPU (comparing data)", b.compare / 1e9},
+      {throttled ? "--rate/--iops limit" : "other", other},
+  };
+  size_t worst = 0;
+  for(size_t i = 1; i < sizeof causes / sizeof *causes; ++i)
+    if(causes[i].seconds > causes[worst].seconds)
+      worst = i;
+  const double share = wall > 0 ? 100 * causes[worst].seconds / wall : 0;
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  fprintf(output,
+          "%s: %s time %.3fs: generate %.3fs, compare %.3fs, %s wait %.3fs, "
+          "open %.3fs, sync %.3fs, close %.3fs, other %.3fs\n",
+          t.path, writing ? "write" : "verify", wall, b.generate / 1e9,
+          b.compare / 1e9, writing ? "write" : "read", b.io / 1e9,
+          b.open / 1e9, b.sync / 1e9, b.close / 1e9, other);
+  fprintf(output,
+          "%s: CPU user %.3fs, system %.3fs (%.0f%% busy); "
+          "bottleneck: %s (%.0f%% of the time)\n",
+          t.path, user, system, wall > 0 ? 100 * (user + system) / wall : 0.0,
+          causes[worst].what, share);
+  flushoutput();
+}
+
+// Open T's --perf-counters for the calling thread. If that's impossible,
+// say why (once) and carry on without them.
+static void openPerf(Target &t) {
+  static std::atomic<bool> moaned(false);
+  std::string error;
+  // With --mirror the data is generated on the main thread, which counters
+  // opened here would not see
+  if(t.perfCompare.open(error) && (mirror || t.perfGenerate.open(error)))
+    return;
+  t.perfCompare.close();
+  if(!moaned.exchange(true)) {
+    std::lock_guard<std::mutex> guard(output_lock);
+    clearprogress();
+    fprintf(stderr, "WARNING: --perf-counters unavailable: %s\n",
+            error.c_str());
+  }
+}
+
+// Report COUNTERS, which covered WHAT, for T.
+static void reportCounters(const Target &t, const char *what,
+                           const PerfCounters &counters) {
+  const uint64_t bytes = counters.processed();
+  if(!counters.opened() || !bytes)
+    return;
+  uint64_t values[PerfCounters::COUNTERS];
+  bool have[PerfCounters::COUNTERS];
+  for(int n = 0; n < PerfCounters::COUNTERS; ++n)
+    have[n] = counters.read((PerfCounters::Counter)n, values[n]);
+  if(!have[PerfCounters::CYCLES])
+    return;
+  fprintf(output, "%s: %s: %.2f cycles/byte", t.path, what,
+          (double)values[PerfCounters::CYCLES] / bytes);
+  if(have[PerfCounters::INSTRUCTIONS])
+    fprintf(output, ", %.2f instructions/byte, %.2f IPC",
+            (double)values[PerfCounters::INSTRUCTIONS] / bytes,
+            values[PerfCounters::CYCLES]
+                ? (double)values[PerfCounters::INSTRUCTIONS]
+                      / values[PerfCounters::CYCLES]
+                : 0.0);
+  if(have[PerfCounters::CACHE_MISSES])
+    fprintf(output, ", %llu cache misses",
+            (unsigned long long)values[PerfCounters::CACHE_MISSES]);
+  if(have[PerfCounters::BRANCH_MISSES])
+    fprintf(output, ", %llu branch misses",
+            (unsigned long long)values[PerfCounters::BRANCH_MISSES]);
+  fprintf(output, " over %llu sampled bytes\n", (unsigned long long)bytes);
+}
+
+// Report T's --perf-counters for the phase that has just finished, and
+// close them.
+static void reportPerf(Target &t) {
+  {
+    std::lock_guard<std::mutex> guard(output_lock);
+    clearprogress();
+    const std::string generating =
+        std::string("generate (") + (report_rng ? report_rng : "rng") + ")";
+    reportCounters(t, generating.c_str(), t.perfGenerate);
+    reportCounters(t, "compare", t.perfCompare);
+    flushoutput();
+  }
+  t.perfGenerate.close();
+  t.perfCompare.close();
+}
+
+// Add a slow I/O of BYTES at OFFSET taking ELAPSED ns to T's slow extents,
+// merging it with the previous one if they are adjacent.
+static void addSlow(Target &t, long long offset, long long bytes,
+                    uint64_t elapsed) {
+  if(!t.slow.empty()) {
+    SlowExtent &last = t.slow.back();
+    if(last.offset + last.length == offset) {
+      last.length += bytes;
+      ++last.count;
+      if(elapsed > last.worst)
+        last.worst = elapsed;
+      return;
+    }
+  }
+  SlowExtent e;
+  e.offset = offset;
+  e.length = bytes;
+  e.count = 1;
+  e.worst = elapsed;
+  t.slow.push_back(e);
+}
+
+// Note the start of a read or write of BYTES at OFFSET in T, and return the
+// time, for timed().
+static inline uint64_t ioStart(const Target &t, long long offset,
+                               size_t bytes, bool writing) {
+  PROBE4(io__start, t.path, offset, bytes, writing);
+  return nanos();
+}
+
+// Record the latency of an I/O of BYTES at OFFSET in T that started at
+// BEFORE.
+static inline void timed(Target &t, long long offset, size_t bytes,
+                         uint64_t before) {
+  const uint64_t elapsed = nanos() - before;
+  PROBE4(io__done, t.path, offset, bytes, elapsed);
+  t.latency.add(elapsed);
+  t.times.io += elapsed;
+  if(__builtin_expect(elapsed >= slow_threshold, 0))
+    addSlow(t, offset, bytes, elapsed);
+}
+
+// Report T's slow extents, sorted and merged, and write them to the slow
+// extent map.
+static void reportSlow(Target &t, bool writing) {
+  if(t.slow.empty())
+    return;
+  std::vector<SlowExtent> slow;
+  slow.swap(t.slow);
+  std::sort(slow.begin(), slow.end(),
+            [](const SlowExtent &a, const SlowExtent &b) {
+              return a.offset < b.offset;
+            });
+  long long count = 0;
+  for(size_t i = 0; i < slow.size(); ++i) {
+    const SlowExtent &e = slow[i];
+    count += e.count;
+    SlowExtent *last = t.slow.empty() ? 0 : &t.slow.back();
+    if(last && last->offset + last->length >= e.offset) {
+      if(e.offset + e.length > last->offset + last->length)
+        last->length = e.offset + e.length - last->offset;
+      last->count += e.count;
+      if(e.worst > last->worst)
+        last->worst = e.worst;
+    } else
+      t.slow.push_back(e);
+  }
+  const char *phase = writing ? "write" : "read";
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  fprintf(output, "%s: %lld slow %s%s (at least %.3fms) in %zu extent%s\n",
+          t.path, count, phase, count == 1 ? "" : "s", slow_threshold / 1e6,
+          t.slow.size(), t.slow.size() == 1 ? "" : "s");
+  for(size_t i = 0; i < t.slow.size(); ++i) {
+    const SlowExtent &e = t.slow[i];
+    if(i < SLOW_SHOWN)
+      fprintf(output, "  %lld-%lld: %lld %s%s, worst %.3fms\n", e.offset,
+              e.offset + e.length - 1, e.count, phase,
+              e.count == 1 ? "" : "s", e.worst / 1e6);
+    else if(i == SLOW_SHOWN)
+      fprintf(output, "  ... and %zu more\n", t.slow.size() - SLOW_SHOWN);
+    if(slow_map)
+      fprintf(slow_map, "%lld %lld %lld %.3f %s %s\n", e.offset, e.length,
+              e.count, e.worst / 1e6, phase, t.path);
+  }
+  flushoutput();
+  if(slow_map && fflush(slow_map) < 0)
+    fatal(errno, "write slow extent map");
+}
+
+// Record a --trace window for T, ending when DONE bytes have been written
+// (if WRITING) or verified.
+static void traceWindow(Target &t, long long done, bool writing) {
+  const double when = now();
+  TraceRecord r;
+  r.path = t.path;
+  r.phase = writing ? "write" : "verify";
+  r.pass = pass;
+  r.offset = t.traceFrom;
+  r.bytes = done - t.traceFrom;
+  r.elapsed = when - t.started;
+  r.seconds = when - t.traceStarted;
+  trace->record(r);
+  t.traceFrom = done;
+  t.traceStarted = when;
+}
+
+// Record a --trace window for T if DONE has reached the end of one.
+static inline void traceCheck(Target &t, long long done, bool writing) {
+  if(__builtin_expect(trace != 0, 0) && done - t.traceFrom >= trace_window)
+    traceWindow(t, done, writing);
+}
+
+// Record T's final, partial --trace window, if any.
+static void traceFinish(Target &t, bool writing) {
+  if(trace && t.done > t.traceFrom)
+    traceWindow(t, t.done, writing);
+}
+
+// Wait until --rate and --iops allow T another I/O of BYTES. The limits
+// apply to all targets together.
+static void throttle(Target &t, size_t bytes) {
+  ++t.operations;
+  if(byte_bucket.limited())
+    byte_bucket.take(bytes);
+  if(io_bucket.limited())
+    io_bucket.take(1);
+}
+
+// Report the throughput T achieved under --rate and --iops.
+static void reportRate(const Target &t) {
+  const double seconds = now() - t.started;
+  const long long done = t.done;
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  fprintf(output, "%s: achieved %.1f MB/s", t.path,
+          seconds > 0 ? done / seconds / 1e6 : 0.0);
+  if(rate_limit)
+    fprintf(output, " (limit %.1f MB/s)", rate_limit / 1e6);
+  fprintf(output, ", %.0f IOPS", seconds > 0 ? t.operations / seconds : 0.0);
+  if(iops_limit)
+    fprintf(output, " (limit %lld IOPS)", iops_limit);
+  fputc('\n', output);
+  flushoutput();
+}
+
+// Add an extent to T's bad extent map, merging it with the previous one if
+// possible.
+static void mergeBad(Target &t, long long offset, long long length,
+                     bad_kind kind) {
+  if(!t.bad.empty()) {
+    Extent &last = t.bad.back();
+    if(last.kind == kind && last.offset + last.length == offset) {
+      last.length += length;
+      return;
+    }
+  }
+  Extent e;
+  e.offset = offset;
+  e.length = length;
+  e.kind = kind;
+  t.bad.push_back(e);
+}
+
+// Add an extent to T's bad extent map and count its bytes.
+static void addBad(Target &t, long long offset, long long length,
+                   bad_kind kind) {
+  t.badBytes += length;
+  mergeBad(t, offset, length, kind);
+}
+
+// Return the number of bits that differ between A and B
+#if __GNUC__ >= 6 && __x86_64__ && __ELF__ && !__clang__
+__attribute__((target_clones("popcnt", "default")))
+#endif
+static unsigned hamming(const uint8_t *a, const uint8_t *b, size_t bytes) {
+  unsigned bits = 0;
+  size_t n = 0;
+  for(; n + 8 <= bytes; n += 8) {
+    uint64_t x, y;
+    memcpy(&x, a + n, 8);
+    memcpy(&y, b + n, 8);
+    bits += __builtin_popcountll(x ^ y);
+  }
+  for(; n < bytes; ++n)
+    bits += __builtin_popcount(a[n] ^ b[n]);
+  return bits;
+}
+
+// Classify a sector of BYTES where ACTUAL was found instead of EXPECTED.
+// Aliases aren't detected here. FLIPS is set to the number of wrong bits.
+// A few wrong bits are flips even if they leave the wrong bytes 0 or 0xFF.
+static mismatch_kind classify(const uint8_t *expected, const uint8_t *actual,
+                              size_t bytes, unsigned &flips) {
+  flips = hamming(expected, actual, bytes);
+  if(flips <= MAX_BIT_FLIPS)
+    return MISMATCH_BITFLIPS;
+  bool zeros = true, ones = true;
+  for(size_t n = 0; n < bytes; ++n)
+    if(expected[n] != actual[n]) {
+      zeros = zeros && actual[n] == 0;
+      ones = ones && actual[n] == 0xFF;
+    }
+  if(zeros)
+    return MISMATCH_ZEROS;
+  if(ones)
+    return MISMATCH_ONES;
+  return MISMATCH_GARBAGE;
+}
+
+// Return a hash of a sector
+static uint64_t sectorHash(const uint8_t *sector, size_t bytes) {
+  uint64_t h = bytes;
+  for(size_t n = 0; n + 8 <= bytes; n += 8) {
+    uint64_t w;
+    memcpy(&w, sector + n, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+// Note that the sector at AT contains the data for offset OF
+static void addAlias(Target &t, long long at, long long of) {
+  Mismatches &m = t.mismatches;
+  ++m.counts[MISMATCH_ALIASED];
+  if(m.aliasAt < 0) {
+    m.aliasAt = at;
+    m.aliasOf = of;
+  }
+}
+
+// Check whether any of the BYTES of GENERATED, which start at BASE, were
+// previously found in the wrong place. Only called once there are
+// unexplained sectors, so healthy targets don't pay for it.
+static void checkPending(Target &t, const uint8_t *generated, size_t bytes,
+                         long long base) {
+  Mismatches &m = t.mismatches;
+  for(size_t n = 0; n + BAD_SECTOR <= bytes; n += BAD_SECTOR) {
+    auto it = m.pending.find(sectorHash(generated + n, BAD_SECTOR));
+    if(it != m.pending.end() && it->second != base + (long long)n) {
+      --m.counts[MISMATCH_GARBAGE];
+      addAlias(t, it->second, base + n);
+      m.pending.erase(it);
+    }
+  }
+}
+
+// Classify the mismatching sector ACTUAL, of BYTES at OFFSET. Garbage is
+// remembered in case it turns up later in the expected data.
+static void classifySector(Target &t, const uint8_t *expected,
+                           const uint8_t *actual, size_t bytes,
+                           long long offset) {
+  Mismatches &m = t.mismatches;
+  Stamp stamp;
+  if(stamp_unit && offset % stamp_unit == 0 && bytes >= STAMP_SIZE
+     && read_stamp(actual, stamp) && stamp.fingerprint == t.fingerprint
+     && stamp.offset != (uint64_t)offset) {
+    addAlias(t, offset, stamp.offset);
+    return;
+  }
+  unsigned flips;
+  mismatch_kind kind = classify(expected, actual, bytes, flips);
+  ++m.counts[kind];
+  if(kind == MISMATCH_GARBAGE && bytes == BAD_SECTOR
+     && m.pending.size() < MAX_PENDING)
+    m.pending[sectorHash(actual, bytes)] = offset;
+}
+
+// Record each sector of INPUT that doesn't match GENERATED as corrupt. The
+// BYTES compared start at offset BASE.
+static void addMismatches(Target &t, const uint8_t *generated,
+                          const uint8_t *input, size_t bytes, long long base) {
+  size_t n = 0;
+  while(n < bytes) {
+    size_t end = n - (base + n) % BAD_SECTOR + BAD_SECTOR;
+    if(end > bytes)
+      end = bytes;
+    if(memcmp(generated + n, input + n, end - n)) {
+      addBad(t, base + n, end - n, BAD_CORRUPT);
+      classifySector(t, generated + n, input + n, end - n, base + n);
+    }
+    n = end;
+  }
+}
+
+// Report throughput and latency separately for the parts of T that needed
+// recovering and the rest.
+static void reportDegraded(const Target &t) {
+  const Degraded &d = t.degraded;
+  const long long bytes = t.done - d.bytes;
+  const long long chunks = t.chunks - d.chunks;
+  const double seconds = now() - t.started - d.seconds;
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  fprintf(output,
+          "%s: healthy: %lld bytes in %.3fs (%.1f MB/s), "
+          "mean latency %.3fms\n",
+          t.path, bytes, seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+          chunks ? seconds / chunks * 1e3 : 0.0);
+  fprintf(output,
+          "%s: degraded: %lld bytes in %.3fs (%.1f MB/s), %lld reads, "
+          "mean latency %.3fms, worst %.3fms\n",
+          t.path, d.bytes, d.seconds,
+          d.seconds > 0 ? d.bytes / d.seconds / 1e6 : 0.0, d.reads,
+          d.reads ? d.seconds / d.reads * 1e3 : 0.0, d.worst * 1e3);
+  flushoutput();
+}
+
+// Summarize T's bad extents and write them to the map. Fatal if there were
+// any.
+static void reportBad(Target &t) {
+  if(t.degraded.chunks)
+    reportDegraded(t);
+  if(t.bad.empty())
+    return;
+  long long total = 0;
+  std::map<int, size_t> sizes; // log2 of extent size -> number of extents
+  for(size_t i = 0; i < t.bad.size(); ++i) {
+    const Extent &e = t.bad[i];
+    total += e.length;
+    int bucket = 0;
+    while(bucket < 62 && e.length >> (bucket + 1))
+      ++bucket;
+    ++sizes[bucket];
+  }
+  {
+    std::lock_guard<std::mutex> guard(output_lock);
+    clearprogress();
+    fprintf(output, "%s: %lld bad bytes in %zu extent%s\n", t.path, total,
+            t.bad.size(), t.bad.size() == 1 ? "" : "s");
+    for(auto it = sizes.begin(); it != sizes.end(); ++it)
+      fprintf(output, "  %lld-%lld bytes: %zu\n", 1LL << it->first,
+              (2LL << it->first) - 1, it->second);
+    const Mismatches &m = t.mismatches;
+    for(int kind = 0; kind < MISMATCH_KINDS; ++kind)
+      if(m.counts[kind])
+        fprintf(output, "  %s: %lld sectors\n", mismatch_names[kind],
+                m.counts[kind]);
+    if(m.aliasAt >= 0)
+      fprintf(output, "  offset %lld contains the data for offset %lld\n",
+              m.aliasAt, m.aliasOf);
+    flushoutput();
+    if(bad_map) {
+      for(size_t i = 0; i < t.bad.size(); ++i)
+        fprintf(bad_map, "%lld %lld %s %s\n", t.bad[i].offset,
+                t.bad[i].length, bad_kind_names[t.bad[i].kind], t.path);
+      if(fflush(bad_map) < 0)
+        fatal(errno, "write bad extent map");
+    }
+  }
+  recordPhase(t, false);
+  fatal(0, "%s: %lld/%lld bytes bad", t.path, total, t.size.load());
+}
+
+// Fill BUFFER with the next BYTES of T's data, which starts at OFFSET.
+// With --stamp, each unit begins with a stamp recording where it belongs.
+static void generate(Rng *rng, Target &t, uint8_t *buffer, size_t bytes,
+                     long long offset) {
+  const uint64_t before = __builtin_expect(breakdown, 0) ? nanos() : 0;
+  const bool counting = __builtin_expect(perf_counters, 0)
+                        && t.perfGenerate.opened() && t.perfGenerate.start();
+  rng->stream(buffer, bytes);
+  if(counting)
+    t.perfGenerate.stop(bytes);
+  PROBE3(generated, t.path, offset, bytes);
+  if(__builtin_expect(breakdown, 0))
+    t.times.generate += nanos() - before;
+  if(!stamp_unit)
+    return;
+  Stamp stamp;
+  stamp.fingerprint = t.fingerprint;
+  stamp.pass = pass;
+  for(size_t n = 0; n < bytes; n += stamp_unit) {
+    stamp.offset = offset + n;
+    if(bytes - n >= STAMP_SIZE)
+      write_stamp(buffer + n, stamp);
+    else {
+      // A short final unit gets as much of the stamp as fits
+      uint8_t header[STAMP_SIZE];
+      write_stamp(header, stamp);
+      memcpy(buffer + n, header, bytes - n);
+    }
+  }
+}
+
+// Report that T is corrupted at offset BASE + N, where GENERATED was
+// expected and INPUT (of which AVAILABLE bytes are valid) was found. If the
+// unit containing the corruption has someone else's stamp, say whose.
+static void __attribute__((noreturn))
+corrupted(Target &t, const uint8_t *generated, const uint8_t *input,
+          size_t n, size_t available, long long base) {
+  t.errorOffset = base + n;
+  Stamp stamp;
+  if(stamp_unit) {
+    size_t unit = n - (base + n) % stamp_unit;
+    long long offset = base + unit;
+    if(available - unit >= STAMP_SIZE && read_stamp(input + unit, stamp)) {
+      if(stamp.fingerprint != t.fingerprint)
+        fatal(0,
+              "%s: offset %lld/%lld contains data from another seed "
+              "(fingerprint %016llx, offset %llu, pass %llu)",
+              t.path, offset, t.size.load(),
+              (unsigned long long)stamp.fingerprint,
+              (unsigned long long)stamp.offset,
+              (unsigned long long)stamp.pass);
+      if(stamp.offset != (uint64_t)offset || stamp.pass != pass)
+        fatal(0,
+              "%s: offset %lld/%lld contains the data written for offset "
+              "%llu, pass %llu",
+              t.path, offset, t.size.load(),
+              (unsigned long long)stamp.offset,
+              (unsigned long long)stamp.pass);
+    }
+  }
+  // Classify the sector containing the first wrong byte
+  size_t start = n - (base + n) % BAD_SECTOR;
+  size_t end = start + BAD_SECTOR < available ? start + BAD_SECTOR : available;
+  unsigned flips;
+  char kind[32];
+  mismatch_kind k =
+      classify(generated + start, input + start, end - start, flips);
+  if(k == MISMATCH_BITFLIPS)
+    snprintf(kind, sizeof kind, "%u bit flip%s", flips, flips == 1 ? "" : "s");
+  else
+    snprintf(kind, sizeof kind, "%s", mismatch_names[k]);
+  fatal(0, "%s: corrupted at %lld/%lld bytes (expected %d got %d, %s)",
+        t.path, base + (long long)n, t.size.load(),
+        (unsigned char)generated[n], (unsigned char)input[n], kind);
+}
+
+// Allocate BYTES of space for FD up front, if it is a regular file.
+// Running out of space is reported immediately rather than after hours of
+// writing; filesystems that can't preallocate are written as normal.
+static void preallocateFile(Target &t, long long bytes) {
+  struct stat sb;
+  if(fstat(t.fd, &sb) < 0)
+    fatal(errno, "fstat %s", t.path);
+  if(!S_ISREG(sb.st_mode) || bytes <= 0)
+    return;
+#if HAVE_FALLOCATE
+  double started = now();
+  if(fallocate(t.fd, 0, 0, bytes) < 0) {
+    if(errno == EOPNOTSUPP || errno == ENOSYS) {
+      fprintf(stderr, "WARNING: %s: preallocation not supported\n", t.path);
+      return;
+    }
+    fatal(errno, "preallocate %s", t.path);
+  }
+  fprintf(output, "%lld bytes (%lldM, %lldG) preallocated in %.3fs\n",
+          bytes, bytes >> 20, bytes >> 30, now() - started);
+  flushoutput();
+#else
+  fprintf(stderr, "WARNING: %s: preallocation not supported\n", t.path);
+#endif
+}
+
+#if HAVE_VMSPLICE
+// Largest pipe buffer to ask for (the default limit for unprivileged users)
+#define SPLICE_BUFFER (1 << 20)
+
+// Write to the pipe FD with vmsplice(), so that the pipe refers to our pages
+// instead of copying them. Return the number of bytes written, or -1 if the
+// pipe can't be used this way (in which case nothing has been written).
+//
+// The pipe, and anything the reader splice()s its contents on to, holds
+// references to the pages rather than copies, so they must never be
+// written again. Each pipe-full is generated in a fresh mapping, which is
+// unmapped once spliced, leaving the pages to the pipe.
+static long long createSpliced(Target &t, bool entire, Rng *rng) {
+  fcntl(t.fd, F_SETPIPE_SZ, SPLICE_BUFFER);
+  int capacity = fcntl(t.fd, F_GETPIPE_SZ);
+  if(capacity <= 0 || capacity % 4096)
+    return -1;
+  long long remain = t.size;
+  bool stopped = false;
+  while(remain > 0 && !stopped) {
+    uint8_t *generated =
+        (uint8_t *)mmap(0, capacity, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(generated == MAP_FAILED)
+      fatal(errno, "allocate splice buffer");
+    size_t bytesGenerated = remain > capacity ? capacity : remain;
+    // Generate in the same units as the unspliced path, so the stream is the
+    // same.
+    for(size_t n = 0; n < bytesGenerated; n += 4096)
+      generate(rng, t, generated + n,
+               bytesGenerated - n > 4096 ? 4096 : bytesGenerated - n,
+               t.size - remain + n);
+    if(throttled)
+      throttle(t, bytesGenerated);
+    struct iovec iov;
+    iov.iov_base = generated;
+    iov.iov_len = bytesGenerated;
+    while(iov.iov_len > 0) {
+      const long long offset =
+          t.size - remain + ((uint8_t *)iov.iov_base - generated);
+      const uint64_t before = ioStart(t, offset, iov.iov_len, true);
+      ssize_t n = vmsplice(t.fd, &iov, 1, 0);
+      timed(t, offset, n > 0 ? n : 0, before);
+      if(n < 0) {
+        if(errno == EINTR)
+          continue;
+        if(errno == EINVAL && remain == t.size && iov.iov_base == generated) {
+          // vmsplice() isn't supported here; start again with write().
+          rng->seed((const uint8_t *)t.seed.data(), t.seed.size());
+          munmap(generated, capacity);
+          return -1;
+        }
+        // With --entire, stop when the reader goes away.
+        if(!entire || errno != EPIPE) {
+          t.errorOffset = offset;
+          fatal(errno, "vmsplice %s", t.path);
+        }
+        stopped = true;
+        break;
+      }
+      iov.iov_base = (uint8_t *)iov.iov_base + n;
+      iov.iov_len -= n;
+    }
+    remain -= bytesGenerated - iov.iov_len;
+    munmap(generated, capacity);
+    traceCheck(t, t.size - remain, true);
+    showprogress(t.size - remain, "writing", false);
+  }
+  return t.size - remain;
+}
+#endif
+
+// Set while a mapping is being compared, so SIGBUS can be recovered from
+static thread_local sigjmp_buf mapped_fault;
+static thread_local volatile sig_atomic_t mapped_active;
+
+// SIGBUS handler for verifyMapped()
+static void mappedFault(int sig) {
+  if(mapped_active) {
+    mapped_active = 0;
+    siglongjmp(mapped_fault, 1);
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// Verify the regular file FD by mapping it, rather than copying it with
+// read(). Return the actual size verified.
+static long long verifyMapped(Target &t, bool entire, Rng *rng) {
+  const int fd = t.fd;
+  const char *const path = t.path;
+  const long long size = t.size;
+  struct stat sb;
+  if(fstat(fd, &sb) < 0)
+    fatal(errno, "fstat %s", path);
+  // With --entire, verify up to the current end of file.
+  long long expected = entire ? sb.st_size : size;
+  // If the file is short, only the part that exists can be mapped.
+  volatile long long limit = sb.st_size < expected ? sb.st_size : expected;
+  // SIGBUS goes to the faulting thread, so one handler serves every thread.
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = mappedFault;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGBUS, &sa, 0) < 0)
+      fatal(errno, "sigaction");
+  });
+  uint8_t generated[4096];
+  // Bytes verified so far. If the file shrinks while it is mapped then the
+  // pending chunk must be compared again against the new limit.
+  volatile long long done = 0;
+  volatile ssize_t pending = 0;
+  while(done < limit) {
+    long long base = done - done % MAPPED_WINDOW;
+    volatile size_t length = (size_t)(limit - base < MAPPED_WINDOW ? limit - base
+                                                          : MAPPED_WINDOW);
+    void *volatile map = mmap(0, length, PROT_READ, MAP_SHARED, fd, base);
+    if(map == MAP_FAILED)
+      fatal(errno, "mmap %s", path);
+#ifdef MADV_SEQUENTIAL
+    madvise(map, length, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise(map, length, MADV_HUGEPAGE);
+#endif
+    if(sigsetjmp(mapped_fault, 1)) {
+      // Either the file was truncated under our feet or the page couldn't
+      // be read; find out where it ends now.
+      munmap(map, length);
+      if(fstat(fd, &sb) < 0)
+        fatal(errno, "fstat %s", path);
+      if(sb.st_size >= limit) {
+        // It's all still there, so this was a read error. Mapping the same
+        // window again would just fault again.
+        if(!keep_going) {
+          t.errorOffset = done;
+          fatal(EIO, "read %s", path);
+        }
+        const long long chunk = pending ? pending : (long long)sizeof generated;
+        const long long bytes = limit - done < chunk ? limit - done : chunk;
+        addBad(t, done, bytes, BAD_UNREADABLE);
+        done += bytes;
+        pending = 0;
+      } else
+        limit = sb.st_size;
+      if(done >= limit)
+        break;
+      continue;
+    }
+    mapped_active = 1;
+    while(done < limit && done < (long long)(base + length)) {
+      if(!pending) {
+        pending = (expected - done > (ssize_t)sizeof generated ? sizeof generated
+                                                               : expected - done);
+        generate(rng, t, generated, pending, done);
+      }
+      ssize_t bytes = (limit - done < pending ? limit - done : pending);
+      if(__builtin_expect(throttled, 0))
+        throttle(t, bytes);
+      const uint8_t *input = (const uint8_t *)map + (done - base);
+      // In a mapping, the time to compare a chunk includes reading it
+      const uint64_t before = ioStart(t, done, bytes, false);
+      const int different = memcmp(generated, input, bytes);
+      timed(t, done, bytes, before);
+      if(different) {
+        PROBE2(mismatch, t.path, done);
+        mapped_active = 0;
+        // The tail of the last page of a truncated file reads as zeros
+        if(fstat(fd, &sb) == 0 && sb.st_size < done + bytes) {
+          if(!keep_going) {
+            t.errorOffset = sb.st_size;
+            fatal(0, "%s: truncated at %lld/%lld bytes", path,
+                  (long long)sb.st_size, size);
+          }
+          // Check what's left, and record the rest as missing below
+          limit = sb.st_size;
+          mapped_active = 1;
+          continue;
+        }
+        if(keep_going)
+          addMismatches(t, generated, input, bytes, done);
+        else
+          for(ssize_t n = 0; n < bytes; ++n)
+            if(generated[n] != input[n])
+              corrupted(t, generated, input, n, bytes, done);
+        mapped_active = 1;
+      }
+      if(__builtin_expect(!t.mismatches.pending.empty(), 0))
+        checkPending(t, generated, bytes, done);
+      done += bytes;
+      pending = 0;
+      traceCheck(t, done, false);
+      showprogress(done, "verifying", false);
+    }
+    mapped_active = 0;
+    if(munmap(map, length) < 0)
+      fatal(errno, "munmap %s", path);
+  }
+  // The file may have shrunk below the part already verified
+  if(limit < done)
+    done = limit;
+  if(done < expected) {
+    // With --entire --verify, we'll report how far we got.
+    if(entire)
+      return done;
+    if(keep_going) {
+      addBad(t, done, expected - done, BAD_MISSING);
+      return done;
+    }
+    t.errorOffset = done;
+    fatal(0, "%s: truncated at %lld/%lld bytes", path, (long long)done, size);
+  }
+  if(!entire && sb.st_size > size) {
+    t.errorOffset = size;
+    fatal(0, "%s: extended beyond %lld bytes", path, size);
+  }
+  return done;
+}
+
+// Drop LENGTH bytes of T at OFFSET from the cache, once they have been
+// verified, so that --scrub doesn't displace anything more useful.
+static void dropCached(const Target &t, long long offset, long long length) {
+#if HAVE_POSIX_FADVISE
+  posix_fadvise(t.fd, offset, length, POSIX_FADV_DONTNEED);
+#else
+  (void)t;
+  (void)offset;
+  (void)length;
+#endif
+}
+
+// Write a chunk to T's current position, which is OFFSET. Return false if
+// the target is full.
+static bool writeChunk(Target &t, long long offset, const uint8_t *generated,
+                       size_t bytes, bool entire) {
+  if(__builtin_expect(throttled, 0))
+    throttle(t, bytes);
+  const uint64_t before = ioStart(t, offset, bytes, true);
+  ssize_t bytesWritten = writeall(t.fd, generated, bytes);
+  timed(t, offset, bytes, before);
+  if(bytesWritten < 0) {
+    // Normally, errors are just fatal.
+    // In --entire, or sizeless --both, we accept ENOSPC and stop at that
+    // point. Similarly a pipe reader may stop when it has had enough.
+    if(!entire || (errno != ENOSPC && errno != EPIPE)) {
+      t.errorOffset = offset;
+      fatal(errno, "write %s", t.path);
+    }
+    if(errno == ENOSPC)
+      PROBE2(enospc, t.path, offset);
+    return false;
+  }
+  assert((size_t)bytesWritten == bytes);
+  t.done += bytesWritten;
+  traceCheck(t, t.done, true);
+  return true;
+}
+
+// Return the logical block size of FD, the smallest unit worth retrying.
+static size_t logicalBlock(int fd) {
+#ifdef BLKSSZGET
+  int size;
+  if(ioctl(fd, BLKSSZGET, &size) == 0 && size > 0)
+    return size;
+#endif
+  (void)fd;
+  return 512;
+}
+
+// State of the recovery of a chunk
+struct Recovery {
+  Target &t;
+  const uint8_t *generated;
+  uint8_t *input;
+  long long base;   // offset of the chunk
+  size_t block;     // logical block size
+  size_t available; // how much of the chunk exists
+
+  Recovery(Target &t_, long long base_, const uint8_t *generated_,
+           uint8_t *input_, size_t bytes):
+      t(t_), generated(generated_), input(input_), base(base_),
+      block(logicalBlock(t_.fd)), available(bytes) {}
+};
+
+// Read LEN bytes at OFFSET in the chunk, retrying, and if that fails,
+// reading each half separately, down to the logical block size. Parts that
+// can't be read are recorded as bad and given the expected contents, so
+// that they aren't reported again as corrupt.
+static void recoverRange(Recovery &r, size_t offset, size_t len) {
+  Target &t = r.t;
+  long long start = r.base + offset;
+  if(start >= t.skipFrom && start < t.skipTo) {
+    size_t skip = t.skipTo - start < (long long)len ? t.skipTo - start : len;
+    addBad(t, start, skip, BAD_SKIPPED);
+    memcpy(r.input + offset, r.generated + offset, skip);
+    offset += skip;
+    start += skip;
+    len -= skip;
+    if(!len)
+      return;
+  }
+  ssize_t n = -1;
+  for(int attempt = 0; attempt <= retries && n < 0; ++attempt) {
+    double before = now();
+    n = pread(t.fd, r.input + offset, len, start);
+    double latency = now() - before;
+    ++t.degraded.reads;
+    if(latency > t.degraded.worst)
+      t.degraded.worst = latency;
+  }
+  if(n >= 0) {
+    if((size_t)n < len && offset + n < r.available)
+      r.available = offset + n;
+    return;
+  }
+  if(len <= r.block) {
+    addBad(t, start, len, BAD_UNREADABLE);
+    memcpy(r.input + offset, r.generated + offset, len);
+    if(skip_on_error) {
+      t.skipFrom = start + len;
+      t.skipTo = start + len + skip_on_error;
+    }
+    return;
+  }
+  size_t half = (len / 2 + r.block - 1) / r.block * r.block;
+  recoverRange(r, offset, half);
+  if(offset + half < r.available)
+    recoverRange(r, offset + half, len - half);
+}
+
+// Read a chunk of BYTES at OFFSET in T that couldn't be read in one go, or
+// that overlaps a region being skipped. ERROR is the errno value from the
+// failed read. Return the number of bytes of the chunk that exist.
+static size_t recoverChunk(Target &t, long long offset,
+                           const uint8_t *generated, uint8_t *input,
+                           size_t bytes, int error) {
+  // Only seekable targets can be recovered
+  if(lseek(t.fd, 0, SEEK_CUR) < 0) {
+    t.errorOffset = offset;
+    fatal(error, "read %s", t.path);
+  }
+  double started = now();
+  Recovery r(t, offset, generated, input, bytes);
+  recoverRange(r, 0, bytes);
+  if(lseek(t.fd, offset + r.available, SEEK_SET) < 0)
+    fatal(errno, "lseek %s", t.path);
+  ++t.degraded.chunks;
+  t.degraded.bytes += r.available;
+  t.degraded.seconds += now() - started;
+  return r.available;
+}
+
+// Read a chunk of BYTES from T's current position, which is OFFSET, into
+// INPUT and check it matches GENERATED. Return the number of bytes read.
+static size_t checkChunk(Target &t, long long offset, const uint8_t *generated,
+                         uint8_t *input, size_t bytes) {
+  // Read from the device. With --keep-going, chunks with read errors (or
+  // that are being skipped) are read more carefully. Otherwise read errors
+  // are fatal.
+  ssize_t bytesRead;
+  ++t.chunks;
+  if(__builtin_expect(throttled, 0))
+    throttle(t, bytes);
+  if(__builtin_expect(
+         offset < t.skipTo && offset + (long long)bytes > t.skipFrom, 0))
+    bytesRead = recoverChunk(t, offset, generated, input, bytes, 0);
+  else {
+    const uint64_t before = ioStart(t, offset, bytes, false);
+    bytesRead = readall(t.fd, input, bytes);
+    timed(t, offset, bytes, before);
+    if(bytesRead < 0) {
+      if(!keep_going) {
+        t.errorOffset = offset;
+        fatal(errno, "read %s", t.path);
+      }
+      bytesRead = recoverChunk(t, offset, generated, input, bytes, errno);
+    }
+  }
+  // Verify that the device had the expected data.
+  const uint64_t before = __builtin_expect(breakdown, 0) ? nanos() : 0;
+  const bool counting = __builtin_expect(perf_counters, 0)
+                        && t.perfCompare.opened() && t.perfCompare.start();
+  const bool differ = memcmp(generated, input, bytesRead);
+  if(counting)
+    t.perfCompare.stop(bytesRead);
+  if(__builtin_expect(breakdown, 0))
+    t.times.compare += nanos() - before;
+  if(differ) {
+    PROBE2(mismatch, t.path, offset);
+    if(keep_going)
+      addMismatches(t, generated, input, bytesRead, offset);
+    else
+      for(ssize_t n = 0; n < bytesRead; ++n)
+        if(generated[n] != input[n])
+          corrupted(t, generated, input, n, bytesRead, offset);
+  }
+  if(__builtin_expect(!t.mismatches.pending.empty(), 0))
+    checkPending(t, generated, bytesRead, offset);
+  return bytesRead;
+}
+
+// Read a chunk from T into INPUT and check it matches GENERATED. Return
+// false if the target ended early.
+static bool verifyChunk(Target &t, const uint8_t *generated, uint8_t *input,
+                        size_t bytes, bool entire) {
+  const size_t bytesRead = checkChunk(t, t.done, generated, input, bytes);
+  t.done += bytesRead;
+  traceCheck(t, t.done, false);
+  /* Truncated */
+  if(bytesRead < bytes) {
+    // With --entire --verify, we'll report how far we got.
+    if(entire)
+      return false;
+    if(keep_going) {
+      addBad(t, t.done, t.size - t.done, BAD_MISSING);
+      return false;
+    }
+    // Otherwise short reads are fatal.
+    t.errorOffset = t.done;
+    fatal(0, "%s: truncated at %lld/%lld bytes", t.path, t.done.load(),
+          t.size.load());
+  }
+  return true;
+}
+
+// Make sure there isn't any more of T past the expected stopping point.
+static void verifyEnd(Target &t) {
+  uint8_t input[1];
+  ssize_t bytesRead = readall(t.fd, input, 1);
+  if(bytesRead != 0)
+    t.errorOffset = t.size;
+  if(bytesRead < 0)
+    fatal(errno, "read %s", t.path);
+  if(bytesRead != 0)
+    fatal(0, "%s: extended beyond %lld bytes", t.path, t.size.load());
+}
+
+// Open T for writing or verifying.
+static void openTarget(mode_type mode, bool entire, Target &t) {
+  t.times = Breakdown();
+  if(breakdown)
+    threadUsage(t.times.usage);
+  if(perf_counters)
+    openPerf(t);
+  t.times.started = now();
+  uint64_t before = nanos();
+  if(streaming)
+    t.fd = mode == VERIFY ? 0 : 1;
+  else
+    t.fd = open(t.path,
+                mode == VERIFY ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(t.fd < 0)
+    fatal(errno, "open %s", t.path);
+  t.times.open = nanos() - before;
+  t.done = 0;
+  t.latency.clear();
+  t.slow.clear();
+  t.operations = 0;
+  PROBE3(phase__start, t.path, mode == VERIFY ? "verify" : "write", pass);
+  if(mode == VERIFY && flush) {
+    PROBE2(flush__start, t.path, t.fd);
+    before = nanos();
+    flushCache(t.fd);
+    t.times.sync = nanos() - before;
+    PROBE2(flush__done, t.path, t.times.sync);
+  }
+  // With --entire the final size isn't known, so there is nothing to
+  // allocate. The phase starts afterwards, so that allocating counts
+  // against neither its throughput nor its first --trace window.
+  if(mode == CREATE && preallocate && !entire)
+    preallocateFile(t, t.size);
+  t.started = now();
+  t.activity = mode == VERIFY ? "verifying" : "writing";
+  t.traceFrom = 0;
+  t.traceStarted = t.started;
+  if(t.size != LLONG_MAX)
+    startprogress(t.size);
+  else if(progress && !worker && !streaming) {
+    // A device knows its size; for anything else, the end is unknown.
+    const off_t end = lseek(t.fd, 0, SEEK_END);
+    if(lseek(t.fd, 0, SEEK_SET) < 0)
+      fatal(errno, "lseek %s", t.path);
+    startprogress(end > 0 ? end : 0);
+  } else
+    startprogress(0);
+}
+
 // Write/verify the target file. Return the actual size.
 static long long execute(mode_type mode, bool entire, const char *show,
-                         Rng *rng) {
-  rng->seed((const uint8_t *)seed, seedlen);
-  int fd = open(path, mode == VERIFY ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC,
-                0666);
-  if(fd < 0)
-    fatal(errno, "open %s", path);
-  if(mode == VERIFY && flush)
-    flushCache(fd);
+                         Rng *rng, Target &t) {
+  if(ordered)
+    return executeOrdered(mode, entire, show, rng, t);
+  rng->seed((const uint8_t *)t.seed.data(), t.seed.size());
+  openTarget(mode, entire, t);
+  struct stat sb;
+  if(mode == VERIFY && io_mode == IO_MMAP && fstat(t.fd, &sb) == 0
+     && S_ISREG(sb.st_mode)) {
+    t.done = verifyMapped(t, entire, rng);
+    reportBad(t);
+    return finish(mode, t, show);
+  }
+#if HAVE_VMSPLICE
+  if(mode == CREATE && fstat(t.fd, &sb) == 0 && S_ISFIFO(sb.st_mode)) {
+    long long done = createSpliced(t, entire, rng);
+    if(done >= 0) {
+      t.done = done;
+      return finish(mode, t, show);
+    }
+  }
+#endif
   uint8_t generated[4096], input[4096];
   // Read/write requested size.
   // (For writes with --entire, or --both to a block device without an explicit
   // size, try to write up to LLONG_MAX.)
-  long long remain = size;
-  while(remain > 0) {
+  while(t.done < t.size) {
     // Get enough random data
+    long long remain = t.size - t.done;
     ssize_t bytesGenerated =
         (remain > (ssize_t)sizeof generated ? sizeof generated : remain);
-    rng->stream(generated, bytesGenerated);
-    if(mode == CREATE) {
-      // Write to the device.
-      ssize_t bytesWritten = writeall(fd, generated, bytesGenerated);
-      if(bytesWritten < 0) {
-        // Normally, errors are just fatal.
-        // In --entire, or sizeless --both, we accept ENOSPC and stop at that
-        // point.
-        if(!entire || errno != ENOSPC)
-          fatal(errno, "write %s", path);
+    generate(rng, t, generated, bytesGenerated, t.done);
+    if(mode == CREATE ? !writeChunk(t, t.done, generated, bytesGenerated, entire)
+                      : !verifyChunk(t, generated, input, bytesGenerated,
+                                     entire))
+      break;
+    if(__builtin_expect(uncached, 0) && t.done % UNCACHED_WINDOW == 0)
+      dropCached(t, t.done - UNCACHED_WINDOW, UNCACHED_WINDOW);
+    showprogress(t.done, mode == VERIFY ? "verifying" : "writing", false);
+  }
+  if(uncached)
+    dropCached(t, 0, 0);
+  if(mode == VERIFY)
+    reportBad(t);
+  if(mode == VERIFY && !entire)
+    verifyEnd(t);
+  /* Actual size written/verified */
+  return finish(mode, t, show);
+}
+
+// Flush and close T after writing/verifying it.
+static void closeTarget(mode_type mode, Target &t) {
+  uint64_t before = nanos();
+  if(mode == CREATE && flush) {
+    PROBE2(flush__start, t.path, t.fd);
+    flushCache(t.fd);
+    PROBE2(flush__done, t.path, nanos() - before);
+  }
+  t.times.sync += nanos() - before;
+  before = nanos();
+  if(close(t.fd) < 0)
+    fatal(errno, "close %s", t.path);
+  t.times.close = nanos() - before;
+  t.fd = -1;
+}
+
+// Finish with T after writing/verifying it. Return the actual size.
+static long long finish(mode_type mode, Target &t, const char *show) {
+  showprogress(t.done, "flushing", true);
+  closeTarget(mode, t);
+  traceFinish(t, mode == CREATE);
+  recordPhase(t, mode == CREATE);
+  if(throttled)
+    reportRate(t);
+  if(latency)
+    reportLatency(t, mode == CREATE);
+  if(breakdown)
+    reportBreakdown(t, mode == CREATE);
+  if(perf_counters)
+    reportPerf(t);
+  reportSlow(t, mode == CREATE);
+  clearprogress();
+  if(show) {
+    const long long done = t.done;
+    fprintf(output, "%lld bytes (%lldM, %lldG) %s\n", done, done >> 20,
+            done >> 30, show);
+    flushoutput();
+  }
+  return t.done;
+}
+
+// Seed RNG for BLOCK of T. With --order each block's data depends only on
+// its offset, so blocks can be written and verified in any order.
+static void seedBlock(Rng *rng, const Target &t, long long block) {
+  std::string key = t.seed;
+  char suffix[32];
+  snprintf(suffix, sizeof suffix, "#%lld", block);
+  key += suffix;
+  rng->seed((const uint8_t *)key.data(), key.size());
+}
+
+// Sort T's bad extents by offset and merge any that are adjacent.
+static void sortBad(Target &t) {
+  std::vector<Extent> bad;
+  bad.swap(t.bad);
+  std::sort(bad.begin(), bad.end(), [](const Extent &a, const Extent &b) {
+    return a.offset < b.offset;
+  });
+  for(size_t i = 0; i < bad.size(); ++i)
+    mergeBad(t, bad[i].offset, bad[i].length, bad[i].kind);
+}
+
+// Write/verify T a block at a time, visiting the blocks in the order given
+// by --order. Return the actual size.
+static long long executeOrdered(mode_type mode, bool entire, const char *show,
+                                Rng *rng, Target &t) {
+  openTarget(mode, entire, t);
+  // Seeking around needs the size up front
+  long long size = t.size, end = lseek(t.fd, 0, SEEK_END);
+  if(end < 0)
+    fatal(errno, "lseek %s", t.path);
+  if(size == LLONG_MAX)
+    size = end;
+  if(size <= 0)
+    fatal(0, "%s: --order needs a size", t.path);
+  if(mode == VERIFY && end != size) {
+    if(end > size && !entire)
+      fatal(0, "%s: extended beyond %lld bytes", t.path, size);
+    if(!keep_going)
+      fatal(0, "%s: truncated at %lld/%lld bytes", t.path, end, size);
+    addBad(t, end, size - end, BAD_MISSING);
+    size = end;
+  }
+  const long long blocks = (size + ORDER_BLOCK - 1) / ORDER_BLOCK;
+  const BlockOrder order(order_kind, blocks, order_stride, t.fingerprint);
+  uint8_t generated[4096], input[4096];
+  for(long long i = 0; i < blocks; ++i) {
+    const long long block = order.block(i);
+    long long offset = block * ORDER_BLOCK;
+    const long long limit = std::min(offset + ORDER_BLOCK, size);
+    if(lseek(t.fd, offset, SEEK_SET) < 0)
+      fatal(errno, "lseek %s", t.path);
+    seedBlock(rng, t, block);
+    while(offset < limit) {
+      const size_t bytes =
+          std::min((long long)sizeof generated, limit - offset);
+      generate(rng, t, generated, bytes, offset);
+      if(mode == CREATE)
+        writeChunk(t, offset, generated, bytes, false);
+      else {
+        const size_t bytesRead =
+            checkChunk(t, offset, generated, input, bytes);
+        t.done += bytesRead;
+        traceCheck(t, t.done, false);
+        // The target shrank while we were reading it
+        if(bytesRead < bytes) {
+          if(!keep_going)
+            fatal(0, "%s: truncated at %lld/%lld bytes", t.path,
+                  offset + (long long)bytesRead, size);
+          addBad(t, offset + bytesRead, limit - offset - bytesRead,
+                 BAD_MISSING);
+          break;
+        }
+      }
+      offset += bytes;
+    }
+    if(uncached)
+      dropCached(t, block * ORDER_BLOCK, ORDER_BLOCK);
+    showprogress(t.done, mode == VERIFY ? "verifying" : "writing", false);
+  }
+  if(mode == VERIFY) {
+    sortBad(t);
+    reportBad(t);
+  }
+  return finish(mode, t, show);
+}
+
+// Discard T's contents before the next pass, if it is a block device that
+// supports it. (Ordinary files are truncated by each pass anyway.)
+static void trimTarget(const Target &t) {
+#ifdef BLKDISCARD
+  static bool warned;
+  int fd = open(t.path, O_WRONLY);
+  if(fd < 0)
+    fatal(errno, "open %s", t.path);
+  struct stat sb;
+  if(fstat(fd, &sb) < 0)
+    fatal(errno, "fstat %s", t.path);
+  if(S_ISBLK(sb.st_mode)) {
+    uint64_t range[2] = {0, (uint64_t)t.size};
+    if(ioctl(fd, BLKDISCARD, range) < 0) {
+      if(errno != EOPNOTSUPP)
+        fatal(errno, "discard %s", t.path);
+      if(!warned)
+        fprintf(stderr, "WARNING: %s: TRIM not supported\n", t.path);
+      warned = true;
+    }
+  }
+  close(fd);
+#else
+  (void)t;
+#endif
+}
+
+// Report how pass N of a burn-in went for T, which took SECONDS to WHAT.
+// Record its throughput in RATES.
+static void reportPass(const Target &t, long long n, const char *what,
+                       double seconds, std::vector<double> &rates) {
+  const long long done = t.done;
+  const double rate = seconds > 0 ? done / seconds / 1e6 : 0.0;
+  rates.push_back(rate);
+  clearprogress();
+  fprintf(output, "pass %lld: %s %lld bytes in %.3fs (%.1f MB/s)", n, what,
+          done, seconds, rate);
+  if(t.latency.count())
+    fprintf(output, ", latency %s", formatLatency(t.latency).c_str());
+  if(!strcmp(what, "verify"))
+    fprintf(output, ", %lld chunk%s recovered", t.degraded.chunks,
+            t.degraded.chunks == 1 ? "" : "s");
+  fputc('\n', output);
+  flushoutput();
+}
+
+// Write and verify T repeatedly until --passes or --duration is reached.
+// Each pass has its own seed, derived from the original one, so stale data
+// from an earlier pass can't pass for the current one.
+static void executeBurnin(bool entire, Rng *rng, Target &t) {
+  const std::string master = t.seed;
+  const double started = now();
+  std::vector<double> rates[2];
+  long long n;
+  for(n = 1;; ++n) {
+    if(n > 1 && trim)
+      trimTarget(t);
+    t.seed = master;
+    if(n > 1) {
+      char suffix[32];
+      snprintf(suffix, sizeof suffix, ":%lld", n);
+      t.seed += suffix;
+    }
+    t.fingerprint = seed_fingerprint(t.seed);
+    pass = n - 1;
+    // Only the first pass needs to find the size
+    double before = now();
+    const long long size = execute(CREATE, entire && n == 1, 0, rng, t);
+    reportPass(t, n, "write", now() - before, rates[0]);
+    t.size = size;
+    t.degraded = Degraded();
+    t.chunks = 0;
+    before = now();
+    execute(VERIFY, false, 0, rng, t);
+    reportPass(t, n, "verify", now() - before, rates[1]);
+    if(passes && n >= passes)
+      break;
+    if(duration && now() - started >= duration)
+      break;
+  }
+  if(n < 2)
+    return;
+  // Falling throughput is an early sign of a failing device
+  for(int phase = 0; phase < 2; ++phase) {
+    const std::vector<double> &r = rates[phase];
+    size_t slowest = 0;
+    for(size_t i = 1; i < r.size(); ++i)
+      if(r[i] < r[slowest])
+        slowest = i;
+    fprintf(output,
+            "%s throughput: pass 1 %.1f MB/s, pass %lld %.1f MB/s (%+.1f%%), "
+            "slowest pass %zu %.1f MB/s\n",
+            phase ? "verify" : "write", r.front(), n, r.back(),
+            r.front() > 0 ? (r.back() - r.front()) / r.front() * 100 : 0.0,
+            slowest + 1, r[slowest]);
+  }
+  flushoutput();
+}
+
+// Make sure LENGTH bytes of T at OFFSET have been written, and drop them
+// from the cache so that reading them through READER gets them from the
+// device.
+static void evictRange(Target &t, Target &reader, long long offset,
+                       long long length) {
+  if(fdatasync(t.fd) < 0)
+    fatal(errno, "fdatasync %s", t.path);
+#if HAVE_POSIX_FADVISE
+  posix_fadvise(reader.fd, offset, length, POSIX_FADV_DONTNEED);
+#else
+  (void)reader;
+  (void)offset;
+  (void)length;
+#endif
+}
+
+// Write T and verify it at the same time, reading back each region once
+// the writer is --rolling bytes past it. Return the actual size.
+static long long executeRolling(bool entire, const char *show,
+                                const char *rngname, Target &t) {
+  // The verifier has its own copy of the stream and its own view of T
+  Rng *writer = makeRng(rngname), *verifier = makeRng(rngname);
+  writer->seed((const uint8_t *)t.seed.data(), t.seed.size());
+  verifier->seed((const uint8_t *)t.seed.data(), t.seed.size());
+  openTarget(CREATE, entire, t);
+  Target reader(t);
+  if((reader.fd = open(t.path, O_RDONLY)) < 0)
+    fatal(errno, "open %s", t.path);
+  reader.done = 0;
+  uint8_t generated[4096], input[4096];
+  bool writing = true;
+  for(;;) {
+    if(writing) {
+      long long remain = t.size - t.done;
+      size_t bytes = remain > (long long)sizeof generated ? sizeof generated
+                                                          : remain;
+      generate(writer, t, generated, bytes, t.done);
+      if(!writeChunk(t, t.done, generated, bytes, entire)
+         || t.done >= t.size) {
+        writing = false;
+        reader.size = t.size = t.done.load();
+      }
+    }
+    // While writing, verify whole regions that are far enough behind.
+    // Afterwards, verify whatever is left.
+    long long end = reader.done + ROLLING_REGION;
+    if(writing ? end > t.done - rolling_lag : reader.done >= t.done) {
+      if(!writing)
         break;
+      showprogress(t.done, "writing", false);
+      continue;
+    }
+    if(end > t.done)
+      end = t.done;
+    evictRange(t, reader, reader.done, end - reader.done);
+    while(reader.done < end) {
+      long long remain = end - reader.done;
+      size_t bytes = remain > (long long)sizeof generated ? sizeof generated
+                                                          : remain;
+      generate(verifier, reader, generated, bytes, reader.done);
+      if(!verifyChunk(reader, generated, input, bytes, false)) {
+        // Data already written has gone missing (and --keep-going was given)
+        reportBad(reader);
+        fatal(0, "%s: truncated at %lld/%lld bytes", t.path,
+              reader.done.load(), t.size.load());
       }
-      assert(bytesWritten == bytesGenerated);
-    } else {
-      // Read from the device.
-      ssize_t bytesRead = readall(fd, input, bytesGenerated);
-      // Read errors are always fatal.
-      if(bytesRead < 0)
-        fatal(errno, "read %s", path);
-      // Verify that the device had the expected data.
-      if(memcmp(generated, input, bytesRead)) {
-        for(ssize_t n = 0; n < bytesRead; ++n)
-          if(generated[n] != input[n])
-            fatal(0, "%s: corrupted at %lld/%lld bytes (expected %d got %d)",
-                  path, size - remain + n, size, (unsigned char)generated[n],
-                  (unsigned char)input[n]);
+    }
+    showprogress(writing ? t.done : reader.done,
+                 writing ? "writing" : "verifying", false);
+  }
+  reportBad(reader);
+  verifyEnd(reader);
+  if(close(reader.fd) < 0)
+    fatal(errno, "close %s", t.path);
+  traceFinish(reader, false);
+  recordPhase(reader, false);
+  delete writer;
+  delete verifier;
+  t.done = finish(CREATE, t, show);
+  t.phases.push_back(reader.phases.back());
+  if(latency)
+    reportLatency(reader, false);
+  if(breakdown)
+    reportBreakdown(reader, false);
+  if(perf_counters)
+    reportPerf(reader);
+  reportSlow(reader, false);
+  return t.done;
+}
+
+// Report what is at OFFSET of T, if it is stamped data.
+static void identifyTarget(const Target &t, long long offset) {
+  int fd = streaming ? 0 : open(t.path, O_RDONLY);
+  if(fd < 0)
+    fatal(errno, "open %s", t.path);
+  uint8_t header[STAMP_SIZE];
+  ssize_t n = pread(fd, header, sizeof header, offset);
+  if(n < 0)
+    fatal(errno, "read %s", t.path);
+  close(fd);
+  Stamp stamp;
+  if(n < (ssize_t)sizeof header || !read_stamp(header, stamp))
+    fatal(0, "%s: no stamp at offset %lld", t.path, offset);
+  fprintf(output,
+          "offset %lld: written for offset %llu, pass %llu, "
+          "fingerprint %016llx (%s seed)\n",
+          offset, (unsigned long long)stamp.offset,
+          (unsigned long long)stamp.pass,
+          (unsigned long long)stamp.fingerprint,
+          stamp.fingerprint == t.fingerprint ? "this" : "another");
+  flushoutput();
+}
+
+// State shared between the generator and the per-target threads of --mirror
+struct Mirror {
+  std::mutex lock;
+  std::condition_variable changed;
+  uint8_t *buffers[MIRROR_BUFFERS];
+  size_t bytes[MIRROR_BUFFERS]; // bytes generated in each buffer
+  int users[MIRROR_BUFFERS];    // targets yet to finish with each buffer
+  long long produced;           // number of buffers generated so far
+  bool finished;                // no more buffers will be generated
+  int active;                   // targets still writing/verifying
+};
+
+// Record the failure of T. It's reported immediately since the other
+// targets may take a long time yet.
+static void targetFailed(Target &t, const TargetFailure &e) {
+  t.error = e.what();
+  // Only now may other threads look at error
+  t.failed = true;
+  fprintf(stderr, "ERROR: %s\n", t.error.c_str());
+}
+
+// Write/verify one target of --mirror, using the buffers produced by
+// executeMirror().
+static void mirrorTarget(mode_type mode, bool entire, Target &t, Mirror &m) {
+  worker = true;
+  std::vector<uint8_t> input(mode == VERIFY ? MIRROR_BUFFER : 0);
+  bool going = true;
+  try {
+    openTarget(mode, entire, t);
+  } catch(TargetFailure &e) {
+    targetFailed(t, e);
+    going = false;
+    // Don't leave the generator waiting for this target
+    std::lock_guard<std::mutex> guard(m.lock);
+    --m.active;
+    m.changed.notify_all();
+  }
+  for(long long sequence = 0;; ++sequence) {
+    int slot = sequence % MIRROR_BUFFERS;
+    {
+      std::unique_lock<std::mutex> guard(m.lock);
+      while(m.produced <= sequence && !m.finished)
+        m.changed.wait(guard);
+      if(m.produced <= sequence)
+        break;
+    }
+    // A stopped target still consumes buffers, but does nothing with them.
+    if(going) {
+      try {
+        size_t bytes = m.bytes[slot];
+        if(t.size - t.done < (long long)bytes)
+          bytes = t.size - t.done;
+        if(bytes == 0)
+          going = false;
+        else if(mode == CREATE)
+          going = writeChunk(t, t.done, m.buffers[slot], bytes, entire);
+        else
+          going = verifyChunk(t, m.buffers[slot], &input[0], bytes, entire);
+      } catch(TargetFailure &e) {
+        targetFailed(t, e);
+        going = false;
       }
-      /* Truncated */
-      if(bytesRead < bytesGenerated) {
-        // With --entire --verify, we'll report how far we got.
-        if(entire) {
-          remain -= bytesRead;
-          break;
-        }
-        // Otherwise short reads are fatal.
-        fatal(0, "%s: truncated at %lld/%lld bytes", path,
-              (size - remain + bytesRead), size);
+      if(!going) {
+        std::lock_guard<std::mutex> guard(m.lock);
+        --m.active;
+        m.changed.notify_all();
       }
     }
-    remain -= bytesGenerated;
-    showprogress(size - remain, mode == VERIFY ? "verifying" : "writing",
-                 false);
+    std::lock_guard<std::mutex> guard(m.lock);
+    if(--m.users[slot] == 0)
+      m.changed.notify_all();
   }
-  if(mode == VERIFY && !entire) {
-    // Make sure there isn't any more past the expected stopping point.
-    ssize_t bytesRead = readall(fd, input, 1);
-    if(bytesRead < 0)
-      fatal(errno, "read %s", path);
-    if(bytesRead != 0)
-      fatal(0, "%s: extended beyond %lld bytes", path, size);
+  if(t.fd < 0)
+    return;
+  if(!t.error.empty()) {
+    close(t.fd);
+    t.fd = -1;
+    return;
   }
-  /* Actual size written/verified */
-  long long done = size - remain;
-  showprogress(done, "flushing", true);
-  if(mode == CREATE && flush)
-    flushCache(fd);
-  if(close(fd) < 0)
-    fatal(errno, "close %s", path);
+  try {
+    if(mode == VERIFY)
+      reportBad(t);
+    if(mode == VERIFY && !entire)
+      verifyEnd(t);
+    closeTarget(mode, t);
+    traceFinish(t, mode == CREATE);
+    recordPhase(t, mode == CREATE);
+    if(throttled)
+      reportRate(t);
+    if(latency)
+      reportLatency(t, mode == CREATE);
+    if(breakdown)
+      reportBreakdown(t, mode == CREATE);
+    if(perf_counters)
+      reportPerf(t);
+    reportSlow(t, mode == CREATE);
+  } catch(TargetFailure &e) {
+    targetFailed(t, e);
+  }
+}
+
+// Write/verify several targets with the same contents, generating it only
+// once. Targets that have already failed are skipped.
+static void executeMirror(mode_type mode, bool entire, const char *show,
+                          Rng *rng, std::vector<Target> &targets) {
+  rng->seed((const uint8_t *)targets[0].seed.data(), targets[0].seed.size());
+  Mirror m;
+  m.produced = 0;
+  m.finished = false;
+  m.active = 0;
+  long long total = 0;
+  for(size_t i = 0; i < targets.size(); ++i)
+    if(targets[i].error.empty()) {
+      ++m.active;
+      if(targets[i].size > total)
+        total = targets[i].size;
+    }
+  const int users = m.active;
+  startprogress(total == LLONG_MAX ? 0 : total);
+  for(int slot = 0; slot < MIRROR_BUFFERS; ++slot) {
+    m.buffers[slot] = (uint8_t *)malloc(MIRROR_BUFFER);
+    if(!m.buffers[slot])
+      fatal(errno, "allocate mirror buffer");
+    m.users[slot] = 0;
+  }
+  std::vector<std::thread> threads;
+  for(size_t i = 0; i < targets.size(); ++i)
+    if(targets[i].error.empty())
+      threads.push_back(std::thread(mirrorTarget, mode, entire,
+                                    std::ref(targets[i]), std::ref(m)));
+  long long offset = 0;
+  for(long long sequence = 0; offset < total; ++sequence) {
+    int slot = sequence % MIRROR_BUFFERS;
+    {
+      // Wait until every target has finished with this buffer
+      std::unique_lock<std::mutex> guard(m.lock);
+      while(m.users[slot] > 0 && m.active > 0)
+        m.changed.wait(guard);
+      if(m.active == 0)
+        break;
+    }
+    size_t bytes =
+        total - offset > MIRROR_BUFFER ? MIRROR_BUFFER : total - offset;
+    // Generate in the same units as execute(), so the stream is the same.
+    for(size_t n = 0; n < bytes; n += 4096)
+      generate(rng, targets[0], m.buffers[slot] + n,
+               bytes - n > 4096 ? 4096 : bytes - n, offset + n);
+    {
+      std::lock_guard<std::mutex> guard(m.lock);
+      m.bytes[slot] = bytes;
+      m.users[slot] = users;
+      m.produced = sequence + 1;
+      m.changed.notify_all();
+    }
+    offset += bytes;
+    showprogress(offset, mode == VERIFY ? "verifying" : "writing", false);
+  }
+  {
+    std::lock_guard<std::mutex> guard(m.lock);
+    m.finished = true;
+    m.changed.notify_all();
+  }
+  showprogress(offset, "flushing", true);
+  for(size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  for(int slot = 0; slot < MIRROR_BUFFERS; ++slot)
+    free(m.buffers[slot]);
   clearprogress();
   if(show) {
-    printf("%lld bytes (%lldM, %lldG) %s\n", done, done >> 20, done >> 30,
-           show);
-    flushstdout();
+    for(size_t i = 0; i < targets.size(); ++i) {
+      const Target &t = targets[i];
+      const long long done = t.done;
+      if(t.error.empty())
+        fprintf(output, "%s: %lld bytes (%lldM, %lldG) %s\n", t.path, done,
+                done >> 20, done >> 30, show);
+    }
+    flushoutput();
+  }
+}
+
+// State shared between the threads of executeJobs()
+struct Jobs {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<bool> finished; // which jobs have finished
+};
+
+// Write/verify one target of executeJobs()
+static void runJob(mode_type mode, const char *rngname, std::vector<Target> &targets,
+                   size_t index, Jobs &jobs) {
+  worker = true;
+  Target &t = targets[index];
+  double started = now();
+  Rng *rng = makeRng(rngname);
+  try {
+    if(mode == BOTH && rolling_lag >= 0)
+      executeRolling(t.entire, 0, rngname, t);
+    else if(mode == BOTH) {
+      t.size = execute(CREATE, t.entire, 0, rng, t);
+      execute(VERIFY, false, 0, rng, t);
+    } else
+      execute(mode, t.entire, 0, rng, t);
+  } catch(TargetFailure &e) {
+    targetFailed(t, e);
+    if(t.fd >= 0) {
+      close(t.fd);
+      t.fd = -1;
+    }
+  }
+  delete rng;
+  t.elapsed = now() - started;
+  std::lock_guard<std::mutex> guard(jobs.lock);
+  jobs.finished[index] = true;
+  jobs.changed.notify_all();
+}
+
+// Show the combined progress of executeJobs(), which started at STARTED.
+static void showjobs(const std::vector<Target> &targets, int running,
+                     double started) {
+  long long total = 0;
+  int failed = 0;
+  for(size_t i = 0; i < targets.size(); ++i) {
+    total += targets[i].done;
+    // The jobs are still running, so error can't be looked at yet
+    if(targets[i].failed)
+      ++failed;
+  }
+  const double elapsed = now() - started;
+  char outbuf[AMOUNT_WIDTH + 1];
+  formatAmount(outbuf, total);
+  char line[256];
+  snprintf(line, sizeof line,
+           " %-10s %d running, %d failed... (average %.1f MB/s)", outbuf,
+           running, failed, elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+  std::lock_guard<std::mutex> guard(progress_lock);
+  drawprogress(line);
+}
+
+// Estimate how many bytes T will take to write/verify, for scheduling.
+static long long estimateSize(const Target &t) {
+  if(!t.entire)
+    return t.size;
+  // Devices can tell us their size; ordinary files will just fill up.
+  int fd = open(t.path, O_RDONLY);
+  if(fd < 0)
+    return 0;
+  off_t end = lseek(fd, 0, SEEK_END);
+  close(fd);
+  return end > 0 ? end : 0;
+}
+
+// Choose the next job for executeJobs() to start, or return -1 if none can
+// be started yet. The group with the most work still waiting goes first, so
+// that no controller is left idle at the end while another still has a
+// queue; within that group, the biggest job goes first.
+static int nextJob(const std::vector<Target> &targets,
+                   const std::vector<bool> &started,
+                   const std::vector<std::string> &groups,
+                   const std::vector<long long> &estimates,
+                   std::map<std::string, int> &busy) {
+  std::map<std::string, long long> waiting;
+  for(size_t i = 0; i < targets.size(); ++i)
+    if(!started[i] && (group_limit <= 0 || busy[groups[i]] < group_limit))
+      waiting[groups[i]] += estimates[i] + 1;
+  int best = -1;
+  for(size_t i = 0; i < targets.size(); ++i) {
+    if(started[i] || !waiting.count(groups[i]))
+      continue;
+    if(best < 0 || waiting[groups[i]] > waiting[groups[best]]
+       || (groups[i] == groups[best] && estimates[i] > estimates[best]))
+      best = i;
+  }
+  return best;
+}
+
+// Return T's average rate over the phases it completed, in MB/s. With
+// --both that covers writing and verifying.
+static double jobRate(const Target &t) {
+  long long bytes = 0;
+  double seconds = 0;
+  for(size_t i = 0; i < t.phases.size(); ++i) {
+    bytes += t.phases[i].bytes;
+    seconds += t.phases[i].seconds;
+  }
+  if(seconds <= 0) {
+    bytes = t.done;
+    seconds = t.elapsed;
+  }
+  return seconds > 0 ? bytes / seconds / 1e6 : 0.0;
+}
+
+// Write/verify several targets at once, each independently in its own
+// thread, and report a summary table at the end. Targets that share a
+// controller or hub are limited by --group-limit.
+static void executeJobs(mode_type mode, const char *rngname,
+                        std::vector<Target> &targets) {
+  Jobs jobs;
+  jobs.finished.assign(targets.size(), false);
+  std::vector<bool> started(targets.size(), false), counted(targets.size(),
+                                                            false);
+  std::vector<std::string> groups;
+  std::vector<long long> estimates;
+  for(size_t i = 0; i < targets.size(); ++i) {
+    groups.push_back(device_group(targets[i].path));
+    estimates.push_back(estimateSize(targets[i]));
+  }
+  // Say up front which groups --group-limit will make wait their turn
+  if(group_limit > 0) {
+    std::map<std::string, int> members;
+    for(size_t i = 0; i < groups.size(); ++i)
+      ++members[groups[i]];
+    for(auto it = members.begin(); it != members.end(); ++it)
+      if(it->second > group_limit)
+        fprintf(output,
+                "group %s: %d targets, %d at a time (--group-limit)\n",
+                it->first.c_str(), it->second, group_limit);
+    flushoutput();
+  }
+  std::map<std::string, int> busy;
+  std::vector<std::thread> threads;
+  int running = 0;
+  const double began = now();
+  std::unique_lock<std::mutex> guard(jobs.lock);
+  for(;;) {
+    // Account for jobs that have finished
+    for(size_t i = 0; i < targets.size(); ++i)
+      if(jobs.finished[i] && !counted[i]) {
+        counted[i] = true;
+        --busy[groups[i]];
+        --running;
+      }
+    // Start as many jobs as the limits allow
+    while(!max_jobs || running < max_jobs) {
+      int next = nextJob(targets, started, groups, estimates, busy);
+      if(next < 0)
+        break;
+      started[next] = true;
+      ++busy[groups[next]];
+      ++running;
+      threads.push_back(std::thread(runJob, mode, rngname, std::ref(targets),
+                                    next, std::ref(jobs)));
+    }
+    if(running == 0)
+      break;
+    jobs.changed.wait_for(guard,
+                          std::chrono::duration<double>(progress_interval));
+    if(progress)
+      showjobs(targets, running, began);
+  }
+  guard.unlock();
+  for(size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  clearprogress();
+  int width = 4;
+  for(size_t i = 0; i < targets.size(); ++i)
+    if((int)strlen(targets[i].path) > width)
+      width = strlen(targets[i].path);
+  fprintf(output, "%-*s %-6s %19s %9s %9s %s\n", width, "PATH", "RESULT",
+          "BYTES", "SECONDS", "MB/S", "GROUP");
+  for(size_t i = 0; i < targets.size(); ++i) {
+    const Target &t = targets[i];
+    const long long done = t.done;
+    fprintf(output, "%-*s %-6s %19lld %9.1f %9.1f %s\n", width, t.path,
+            t.error.empty() ? "ok" : "FAILED", done, t.elapsed, jobRate(t),
+            groups[i].c_str());
+  }
+  flushoutput();
+}
+
+// Verify PATH as a scrub canary. Return true if it is intact.
+static bool scrubFile(Rng *rng, const std::string &path, FILE *log) {
+  Target t(path.c_str());
+  t.seed.assign((const char *)seed, seedlen);
+  t.fingerprint = seed_fingerprint(t.seed);
+  const double started = now();
+  bool ok = true;
+  // Failures of this file are reported and scrubbing goes on to the next;
+  // anything else is still fatal.
+  worker = true;
+  try {
+    struct stat sb;
+    if(stat(t.path, &sb) < 0)
+      fatal(errno, "stat %s", t.path);
+    t.size = sb.st_size;
+    execute(VERIFY, false, 0, rng, t);
+  } catch(TargetFailure &e) {
+    targetFailed(t, e);
+    if(t.fd >= 0) {
+      close(t.fd);
+      t.fd = -1;
+    }
+    ok = false;
+  }
+  worker = false;
+  const double elapsed = now() - started;
+  if(ok) {
+    fprintf(output, "%s: OK, %lld bytes in %.3fs\n", t.path, t.done.load(),
+            elapsed);
+    flushoutput();
+  }
+  if(log) {
+    char when[64];
+    const time_t clock = time(0);
+    struct tm tm;
+    strftime(when, sizeof when, "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&clock, &tm));
+    fprintf(log, "%s %s %s %lld %.3f%s%s\n", when, t.path,
+            ok ? "ok" : "failed", t.done.load(), elapsed,
+            ok ? "" : " ", t.error.c_str());
+    if(fflush(log) < 0)
+      fatal(errno, "write %s", history);
+  }
+  return ok;
+}
+
+// Verify every file in --scrub's directory, at idle I/O priority, and
+// then with --interval, do it again, forever. Files whose names start with
+// '.' are skipped. Returns the exit status.
+static int executeScrub(Rng *rng) {
+#if defined SYS_ioprio_set
+  // ioprio_set(IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0))
+  if(syscall(SYS_ioprio_set, 1, 0, 3 << 13) < 0)
+    fprintf(stderr, "WARNING: cannot set idle I/O priority: %s\n",
+            strerror(errno));
+#endif
+  FILE *log = 0;
+  if(history && !(log = fopen(history, "a")))
+    fatal(errno, "open %s", history);
+  uncached = true;
+  int status = 0;
+  for(;;) {
+    const double started = now();
+    DIR *dp = opendir(scrub_dir);
+    if(!dp)
+      fatal(errno, "open %s", scrub_dir);
+    std::vector<std::string> paths;
+    struct dirent *de;
+    while((de = readdir(dp))) {
+      if(de->d_name[0] == '.')
+        continue;
+      std::string path = std::string(scrub_dir) + "/" + de->d_name;
+      struct stat sb;
+      if(stat(path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode))
+        paths.push_back(path);
+    }
+    closedir(dp);
+    std::sort(paths.begin(), paths.end());
+    if(paths.empty())
+      fprintf(stderr, "WARNING: %s: no files to scrub\n", scrub_dir);
+    for(size_t i = 0; i < paths.size(); ++i)
+      if(!scrubFile(rng, paths[i], log))
+        status = 1;
+    if(!scrub_interval)
+      break;
+    const double wait = started + scrub_interval - now();
+    if(wait > 0)
+      std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+  }
+  if(log && fclose(log) < 0)
+    fatal(errno, "write %s", history);
+  return status;
+}
+
+// Write one target's part of the --report to FP.
+static void reportTarget(FILE *fp, const Target &t) {
+  const DeviceIdentity id = device_identity(t.path);
+  fprintf(fp, "    {\n      \"path\": %s,\n", json_quote(t.path).c_str());
+  fprintf(fp,
+          "      \"device\": {\"type\": %s, \"device\": %s, "
+          "\"model\": %s, \"serial\": %s, \"group\": %s},\n",
+          json_quote(id.type).c_str(), json_quote(id.device).c_str(),
+          json_quote(id.model).c_str(), json_quote(id.serial).c_str(),
+          json_quote(id.group).c_str());
+  fprintf(fp, "      \"fingerprint\": \"%016llx\",\n",
+          (unsigned long long)t.fingerprint);
+  if(t.size == LLONG_MAX)
+    fprintf(fp, "      \"size\": null,\n");
+  else
+    fprintf(fp, "      \"size\": %lld,\n", t.size.load());
+  fprintf(fp, "      \"done\": %lld,\n      \"phases\": [", t.done.load());
+  for(size_t i = 0; i < t.phases.size(); ++i) {
+    const Phase &p = t.phases[i];
+    fprintf(fp,
+            "%s\n        {\"pass\": %lld, \"phase\": \"%s\", \"bytes\": %lld, "
+            "\"seconds\": %.6f, \"mbps\": %.3f, \"ios\": %lld, "
+            "\"latency_ms\": {\"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, "
+            "\"p99.9\": %.6f, \"max\": %.6f}, \"slow_ios\": %lld}",
+            i ? "," : "", p.pass, p.writing ? "write" : "verify", p.bytes,
+            p.seconds, p.seconds > 0 ? p.bytes / p.seconds / 1e6 : 0.0, p.ios,
+            p.p50, p.p90, p.p99, p.p999, p.max, p.slow);
+  }
+  fprintf(fp, "%s],\n      \"bad\": [", t.phases.empty() ? "" : "\n      ");
+  for(size_t i = 0; i < t.bad.size(); ++i)
+    fprintf(fp,
+            "%s\n        {\"offset\": %lld, \"length\": %lld, "
+            "\"kind\": \"%s\"}",
+            i ? "," : "", t.bad[i].offset, t.bad[i].length,
+            bad_kind_names[t.bad[i].kind]);
+  fprintf(fp, "%s],\n      \"error\": %s,\n",
+          t.bad.empty() ? "" : "\n      ",
+          t.error.empty() ? "null" : json_quote(t.error).c_str());
+  if(t.errorOffset < 0)
+    fprintf(fp, "      \"error_offset\": null\n    }");
+  else
+    fprintf(fp, "      \"error_offset\": %lld\n    }", t.errorOffset);
+}
+
+// Write the --report, if there is to be one. STATUS is the exit status and
+// REASON says why. Called on the way out, including from fatal().
+static void writeReport(int status, const std::string &reason) {
+  if(!report || reporting)
+    return;
+  reporting = true;
+  // A fatal error with a single target is that target's
+  if(status && report_targets && report_targets->size() == 1
+     && (*report_targets)[0].error.empty())
+    (*report_targets)[0].error = reason;
+  FILE *fp = report_file ? report_file : stdout;
+  fprintf(fp, "{\n  \"version\": %s,\n", json_quote(VERSION).c_str());
+  fprintf(fp, "  \"mode\": %s,\n  \"rng\": %s,\n  \"targets\": [",
+          report_mode ? json_quote(report_mode).c_str() : "null",
+          report_rng ? json_quote(report_rng).c_str() : "null");
+  const size_t count = report_targets ? report_targets->size() : 0;
+  for(size_t i = 0; i < count; ++i) {
+    fputs(i ? ",\n" : "\n", fp);
+    reportTarget(fp, (*report_targets)[i]);
+  }
+  fprintf(fp, "%s],\n  \"exit\": {\"status\": %d, \"reason\": %s}\n}\n",
+          count ? "\n  " : "", status, json_quote(reason).c_str());
+  if(ferror(fp) || fflush(fp) || (report_file && fclose(report_file) < 0)) {
+    // Too late for fatal() if we're already on the way out
+    fprintf(stderr, "ERROR: write %s: %s\n",
+            report_path ? report_path : "report", strerror(errno));
+    exit(1);
+  }
+}
+
+// Write a one-line status for each target to stderr, as requested by
+// SIGUSR1 (or SIGINFO).
+static void showStatus() {
+  if(!report_targets)
+    return;
+  std::lock_guard<std::mutex> guard(output_lock);
+  clearprogress();
+  for(size_t i = 0; i < report_targets->size(); ++i) {
+    const Target &t = (*report_targets)[i];
+    const char *activity = t.activity;
+    const long long done = t.done;
+    const long long size = t.size;
+    if(t.failed) {
+      fprintf(stderr, "%s: failed\n", t.path);
+      continue;
+    }
+    if(!activity) {
+      fprintf(stderr, "%s: idle, pass %llu, %lld bad bytes\n", t.path,
+              (unsigned long long)pass.load(), t.badBytes.load());
+      continue;
+    }
+    const double seconds = now() - t.started;
+    fprintf(stderr, "%s: %s, pass %llu, %lld", t.path, activity,
+            (unsigned long long)pass.load(), done);
+    if(size != LLONG_MAX && size > 0)
+      fprintf(stderr, "/%lld bytes (%.1f%%)", size, 100.0 * done / size);
+    else
+      fprintf(stderr, " bytes");
+    fprintf(stderr, ", %.1f MB/s, p99 %.3fms, %lld bad bytes\n",
+            seconds > 0 ? done / seconds / 1e6 : 0.0,
+            t.latency.percentile(0.99) / 1e6, t.badBytes.load());
+  }
+}
+
+// Wait for status requests for ever. The signals are blocked in every
+// thread, so that they only arrive here.
+static void statusThread(sigset_t signals) {
+  for(;;) {
+    int sig;
+    if(sigwait(&signals, &sig) == 0)
+      showStatus();
+  }
+}
+
+// Arrange for SIGUSR1 (and SIGINFO, where it exists) to print a status
+// line, as dd does. Must be called before any other threads are started.
+static void startStatus() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+#ifdef SIGINFO
+  sigaddset(&signals, SIGINFO);
+#endif
+  if((errno = pthread_sigmask(SIG_BLOCK, &signals, 0)))
+    fatal(errno, "pthread_sigmask");
+  std::thread(statusThread, signals).detach();
+}
+
+// Return S quoted as a Prometheus label value
+static std::string prometheus_quote(const std::string &s) {
+  std::string q = "\"";
+  for(size_t i = 0; i < s.size(); ++i) {
+    switch(s[i]) {
+    case '\\': q += "\\\\"; break;
+    case '"': q += "\\\""; break;
+    case '\n': q += "\\n"; break;
+    default: q += s[i]; break;
+    }
+  }
+  return q + "\"";
+}
+
+// Serializes writes to the metrics file
+static std::mutex metrics_lock;
+
+// Set once the final metrics are written, under metrics_lock, so that a
+// late periodic write cannot replace them
+static bool metrics_final = false;
+
+// Write the HELP and TYPE lines for gauge NAME
+static void metricHeader(FILE *fp, const char *name, const char *help) {
+  fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+// Write the --metrics-file, in the Prometheus text format, to a temporary
+// file and then rename it into place, so that readers never see part of
+// it. STATUS is the exit status, or -1 while still running. Returns false
+// on error, with errno set.
+static bool writeMetrics(int status) {
+  if(!metrics_path)
+    return true;
+  std::lock_guard<std::mutex> guard(metrics_lock);
+  if(metrics_final)
+    return true;
+  const std::string tmp = std::string(metrics_path) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if(!fp)
+    return false;
+  metricHeader(fp, "vbig_running", "Whether vbig is still running.");
+  fprintf(fp, "vbig_running %d\n", status < 0);
+  if(status >= 0) {
+    metricHeader(fp, "vbig_exit_status", "Exit status of vbig.");
+    fprintf(fp, "vbig_exit_status %d\n", status);
+  }
+  metricHeader(fp, "vbig_pass", "Current pass, from 0.");
+  fprintf(fp, "vbig_pass %llu\n", (unsigned long long)pass.load());
+  static const std::vector<Target> none;
+  const std::vector<Target> &targets = report_targets ? *report_targets : none;
+  const size_t count = targets.size();
+  std::vector<std::string> labels(count);
+  for(size_t i = 0; i < count; ++i) {
+    const Target &t = targets[i];
+    const DeviceIdentity id = device_identity(t.path);
+    labels[i] = "path=" + prometheus_quote(t.path)
+                + ",device=" + prometheus_quote(id.device)
+                + ",serial=" + prometheus_quote(id.serial);
+  }
+  metricHeader(fp, "vbig_phase", "What is happening to the target.");
+  for(size_t i = 0; i < count; ++i) {
+    const char *activity = targets[i].activity;
+    fprintf(fp, "vbig_phase{%s,phase=\"%s\"} 1\n", labels[i].c_str(),
+            activity ? activity : "idle");
+  }
+  metricHeader(fp, "vbig_size_bytes", "Expected size of the target.");
+  for(size_t i = 0; i < count; ++i) {
+    const long long size = targets[i].size;
+    if(size != LLONG_MAX)
+      fprintf(fp, "vbig_size_bytes{%s} %lld\n", labels[i].c_str(), size);
+  }
+  metricHeader(fp, "vbig_done_bytes",
+               "Bytes written or verified in this phase.");
+  for(size_t i = 0; i < count; ++i)
+    fprintf(fp, "vbig_done_bytes{%s} %lld\n", labels[i].c_str(),
+            targets[i].done.load());
+  metricHeader(fp, "vbig_rate_bytes_per_second", "Average rate in this phase.");
+  for(size_t i = 0; i < count; ++i) {
+    const Target &t = targets[i];
+    const double seconds = now() - t.started;
+    fprintf(fp, "vbig_rate_bytes_per_second{%s} %.0f\n", labels[i].c_str(),
+            t.activity && seconds > 0 ? t.done / seconds : 0.0);
+  }
+  metricHeader(fp, "vbig_ios", "Reads or writes timed in this phase.");
+  for(size_t i = 0; i < count; ++i)
+    fprintf(fp, "vbig_ios{%s} %llu\n", labels[i].c_str(),
+            (unsigned long long)targets[i].latency.count());
+  metricHeader(fp, "vbig_latency_seconds",
+               "Latency of reads or writes in this phase.");
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  for(size_t i = 0; i < count; ++i)
+    for(size_t q = 0; q < sizeof quantiles / sizeof *quantiles; ++q)
+      fprintf(fp, "vbig_latency_seconds{%s,quantile=\"%g\"} %.9f\n",
+              labels[i].c_str(), quantiles[q],
+              targets[i].latency.percentile(quantiles[q]) / 1e9);
+  metricHeader(fp, "vbig_bad_bytes", "Bytes found to be bad.");
+  for(size_t i = 0; i < count; ++i)
+    fprintf(fp, "vbig_bad_bytes{%s} %lld\n", labels[i].c_str(),
+            targets[i].badBytes.load());
+  metricHeader(fp, "vbig_failed", "Whether the target has failed.");
+  for(size_t i = 0; i < count; ++i)
+    fprintf(fp, "vbig_failed{%s} %d\n", labels[i].c_str(),
+            (int)targets[i].failed);
+  if(ferror(fp)) {
+    const int save = errno;
+    fclose(fp);
+    errno = save;
+    return false;
+  }
+  if(fclose(fp) < 0 || rename(tmp.c_str(), metrics_path) < 0)
+    return false;
+  if(status >= 0)
+    metrics_final = true;
+  return true;
+}
+
+// Rewrite the --metrics-file every METRICS_INTERVAL seconds, for ever.
+static void metricsThread() {
+  bool moaned = false;
+  for(;;) {
+    std::this_thread::sleep_for(std::chrono::seconds(METRICS_INTERVAL));
+    if(!writeMetrics(-1) && !moaned) {
+      fprintf(stderr, "WARNING: write %s: %s\n", metrics_path,
+              strerror(errno));
+      moaned = true;
+    }
   }
-  return done;
 }
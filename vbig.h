@@ -20,11 +20,41 @@
 
 #include <config.h>
 #include <string>
+#include <stdint.h>
+
+class Rng;
+
+// Header identifying a block of data written by vbig
+struct Stamp {
+  uint64_t fingerprint; // identifies the seed
+  uint64_t offset;      // byte offset the block was written for
+  uint64_t pass;        // pass number
+};
+
+// Size of a stamp in bytes
+#define STAMP_SIZE 32
+
+// What a target is and what it is stored on
+struct DeviceIdentity {
+  std::string type;   // "file", "block device", etc.
+  std::string device; // MAJOR:MINOR of the device
+  std::string model;  // the device's model, if known
+  std::string serial; // the device's serial number, if known
+  std::string group;  // see device_group()
+};
 
 void capture(std::string &output, const char *file, const char **args);
 bool safe_path(const std::string &path);
 bool is_block_device(const std::string &path);
 bool block_device_in_use(const std::string &path);
+std::string device_group(const std::string &path);
+DeviceIdentity device_identity(const std::string &path);
+std::string json_quote(const std::string &s);
 void __attribute__((noreturn)) fatal(int errno_value, const char *fmt, ...);
+uint64_t seed_fingerprint(const std::string &seed);
+void write_stamp(uint8_t *block, const Stamp &stamp);
+bool read_stamp(const uint8_t *block, Stamp &stamp);
+long long probe(const char *path, long long &advertised, Rng *rng,
+                const std::string &seed);
 
 #endif /* VBIG_H */